@@ -0,0 +1,192 @@
+#include <cctype>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+
+#include "affinity.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#endif // _WIN32
+
+namespace multi_thread {
+
+const CpuTopology &
+CpuTopology::Instance() {
+    static CpuTopology s_instance = [] {
+        CpuTopology topology;
+        topology.load();
+        return topology;
+    }();
+    return s_instance;
+}
+
+std::vector<int>
+CpuTopology::parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string item = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty() || !isdigit((unsigned char)item[0])) {
+            continue;
+        }
+        size_t dash = item.find('-');
+        int first = atoi(item.c_str());
+        int last = dash == std::string::npos ? first : atoi(item.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// CPUs the process may run on.
+static std::vector<int>
+allowedCpus() {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif // __linux__
+    if (cpus.empty()) {
+        int n = (int)std::thread::hardware_concurrency();
+        for (int cpu = 0; cpu < (n > 0 ? n : 1); ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+void
+CpuTopology::load() {
+    std::vector<int> allowed = allowedCpus();
+#if defined(__linux__)
+    const char *root = "/sys/devices/system/node";
+    std::vector<std::pair<int, std::vector<int>>> found;
+    DIR *dir = opendir(root);
+    if (dir) {
+        dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "node", 4) != 0 || !isdigit((unsigned char)entry->d_name[4])) {
+                continue;
+            }
+            std::ifstream in(std::string(root) + "/" + entry->d_name + "/cpulist");
+            std::string list;
+            if (in && std::getline(in, list)) {
+                found.emplace_back(atoi(entry->d_name + 4), parseCpuList(list));
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(found.begin(), found.end());
+    for (auto &node : found) {
+        _nodes.push_back(node.second);
+    }
+#endif // __linux__
+    // no sysfs information: one node holding everything.
+    if (_nodes.empty()) {
+        _nodes.push_back(allowed);
+    }
+    *this = restrictTo(allowed);
+    if (_nodes.empty()) {
+        _nodes.push_back(allowed);
+        index();
+    }
+}
+
+void
+CpuTopology::index() {
+    _cpuNode.clear();
+    for (size_t node = 0; node < _nodes.size(); ++node) {
+        for (int cpu : _nodes[node]) {
+            if (cpu >= (int)_cpuNode.size()) {
+                _cpuNode.resize(cpu + 1, -1);
+            }
+            _cpuNode[cpu] = (int)node;
+        }
+    }
+}
+
+int
+CpuTopology::nodeOf(int cpu) const {
+    if (cpu < 0 || cpu >= (int)_cpuNode.size() || _cpuNode[cpu] < 0) {
+        return 0;
+    }
+    return _cpuNode[cpu];
+}
+
+CpuTopology
+CpuTopology::restrictTo(const std::vector<int> &cpus) const {
+    CpuTopology result;
+    for (auto &node : _nodes) {
+        std::vector<int> kept;
+        for (int cpu : node) {
+            if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+                kept.push_back(cpu);
+            }
+        }
+        if (!kept.empty()) {
+            result._nodes.push_back(kept);
+        }
+    }
+    result.index();
+    return result;
+}
+
+bool
+setThreadAffinity(const std::vector<int> &cpus) {
+    if (cpus.empty()) {
+        return false;
+    }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < (int)(sizeof(mask) * 8)) {
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+    }
+    return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    return false;
+#endif // __linux__
+}
+
+int
+currentCpu() {
+#if defined(__linux__)
+    return sched_getcpu();
+#elif defined(_WIN32)
+    return (int)GetCurrentProcessorNumber();
+#else
+    return -1;
+#endif // __linux__
+}
+
+}// namespace
@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace multi_thread {
+
+// CPUs grouped by NUMA node, as far as this process may use them.
+// On Linux read from /sys/devices/system/node (no libnuma needed) and
+// restricted to the process' affinity mask; anywhere else, or when sysfs
+// has no node information, all CPUs form a single node 0.
+class CpuTopology {
+public:
+    static const CpuTopology &Instance();
+
+    int nodeCount() const {
+        return (int)_nodes.size();
+    }
+    const std::vector<int> &cpusOf(int node) const {
+        return _nodes[node];
+    }
+    // node of cpu, 0 if unknown.
+    int nodeOf(int cpu) const;
+
+    // the same topology keeping only cpus, nodes left empty are dropped.
+    CpuTopology restrictTo(const std::vector<int> &cpus) const;
+
+    // "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+    static std::vector<int> parseCpuList(const std::string &list);
+private:
+    CpuTopology() {}
+    void load();
+    void index();
+private:
+    std::vector<std::vector<int>> _nodes;
+    // cpu -> position in _nodes, -1 for cpus we do not have.
+    std::vector<int> _cpuNode;
+};
+
+// pin the calling thread to cpus, return false if not supported or the
+// system refused.
+bool setThreadAffinity(const std::vector<int> &cpus);
+
+// the CPU the calling thread runs on, -1 if unknown.
+int currentCpu();
+
+}// namespace
@@ -0,0 +1,378 @@
+// ThreadPool benchmarks.
+//
+//   bench [--threads 1,2,4,8] [--tasks N] [--scenario name[,name]]
+//         [--queue shared,steal,ring] [--format text|csv|json]
+//
+// Every scenario runs on every queue and thread count and reports
+// throughput plus p50/p99/p999 of a per-task latency:
+//   empty      N empty tasks from one producer; submit to start.
+//   fanout     rounds of 64 tasks joined before the next round; round time.
+//   nested     trees of tasks submitting their children; submit to start.
+//   priority   a quarter high, the rest low priority, one producer; submit
+//              to start of the high priority tasks.
+//   producers  4 producer threads per worker; submit to start.
+// csv and json (one object per line) are meant for diffing runs.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "threadPool.h"
+
+
+using namespace multi_thread;
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t
+nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// counts down to zero, the last arrival wakes the waiter. The waiter
+// returns only once that arrival is done with the latch.
+class Latch {
+public:
+    explicit Latch(int64_t n) : _count(n) {}
+    void arrive() {
+        if (_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _released = true;
+            _cond.notify_all();
+        }
+    }
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cond.wait(lock, [this] { return _released; });
+    }
+    void reset(int64_t n) {
+        _count.store(n);
+        _released = false;
+    }
+private:
+    std::atomic<int64_t> _count;
+    bool _released = false;
+    std::mutex _mtx;
+    std::condition_variable _cond;
+};
+
+struct Result {
+    std::string scenario;
+    std::string queue;
+    int threads;
+    int64_t ops;
+    double seconds;
+    // latencies in ns, sorted by report().
+    std::vector<int64_t> latency;
+};
+
+struct Config {
+    std::vector<int> threads;
+    int64_t tasks = 200000;
+    std::vector<std::string> scenarios;
+    std::vector<std::string> queues;
+    std::string format = "text";
+};
+
+static int64_t
+percentile(const std::vector<int64_t> &sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = (size_t)(q * sorted.size());
+    return sorted[i < sorted.size() ? i : sorted.size() - 1];
+}
+
+static void
+report(Result &r, const Config &config, bool first) {
+    std::sort(r.latency.begin(), r.latency.end());
+    double ops = r.seconds > 0 ? r.ops / r.seconds : 0;
+    long long p50 = percentile(r.latency, 0.5), p99 = percentile(r.latency, 0.99), p999 = percentile(r.latency, 0.999);
+    if (config.format == "csv") {
+        if (first) {
+            printf("scenario,queue,threads,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+        }
+        printf("%s,%s,%d,%lld,%.6f,%.0f,%lld,%lld,%lld\n", r.scenario.c_str(), r.queue.c_str(), r.threads,
+               (long long)r.ops, r.seconds, ops, p50, p99, p999);
+    } else if (config.format == "json") {
+        printf("{\"scenario\":\"%s\",\"queue\":\"%s\",\"threads\":%d,\"ops\":%lld,\"seconds\":%.6f,"
+               "\"ops_per_sec\":%.0f,\"p50_ns\":%lld,\"p99_ns\":%lld,\"p999_ns\":%lld}\n",
+               r.scenario.c_str(), r.queue.c_str(), r.threads, (long long)r.ops, r.seconds, ops, p50, p99, p999);
+    } else {
+        if (first) {
+            printf("%-10s %-7s %7s %12s %14s %10s %10s %10s\n",
+                   "scenario", "queue", "threads", "ops", "ops/sec", "p50(ns)", "p99(ns)", "p999(ns)");
+        }
+        printf("%-10s %-7s %7d %12lld %14.0f %10lld %10lld %10lld\n", r.scenario.c_str(), r.queue.c_str(),
+               r.threads, (long long)r.ops, ops, p50, p99, p999);
+    }
+    fflush(stdout);
+}
+
+template<typename Pool>
+static Result
+benchEmpty(Pool &pool, int64_t n) {
+    Result r;
+    r.latency.resize(n);
+    Latch done(n);
+    int64_t *latency = r.latency.data();
+    int64_t start = nowNs();
+    for (int64_t i = 0; i < n; ++i) {
+        int64_t submitted = nowNs();
+        pool.submit([latency, i, submitted, &done] {
+            latency[i] = nowNs() - submitted;
+            done.arrive();
+        });
+    }
+    done.wait();
+    r.ops = n;
+    r.seconds = (nowNs() - start) / 1e9;
+    return r;
+}
+
+template<typename Pool>
+static Result
+benchFanout(Pool &pool, int64_t n) {
+    const int kWidth = 64;
+    int64_t rounds = n / kWidth > 0 ? n / kWidth : 1;
+    Result r;
+    Latch done(kWidth);
+    std::atomic<int64_t> sink{0};
+    int64_t start = nowNs();
+    for (int64_t round = 0; round < rounds; ++round) {
+        int64_t begin = nowNs();
+        done.reset(kWidth);
+        for (int i = 0; i < kWidth; ++i) {
+            pool.submit([&sink, &done, i] {
+                sink.fetch_add(i, std::memory_order_relaxed);
+                done.arrive();
+            });
+        }
+        done.wait();
+        r.latency.push_back(nowNs() - begin);
+    }
+    r.ops = rounds * kWidth;
+    r.seconds = (nowNs() - start) / 1e9;
+    return r;
+}
+
+template<typename Pool>
+struct Tree {
+    Pool *pool;
+    Latch *done;
+    int64_t *latency;
+    std::atomic<int64_t> next{0};
+
+    // a node submits two children until depth runs out.
+    void spawn(int depth) {
+        int64_t submitted = nowNs();
+        pool->submit([this, depth, submitted] {
+            latency[next.fetch_add(1, std::memory_order_relaxed)] = nowNs() - submitted;
+            if (depth > 0) {
+                spawn(depth - 1);
+                spawn(depth - 1);
+            }
+            done->arrive();
+        });
+    }
+};
+
+template<typename Pool>
+static Result
+benchNested(Pool &pool, int64_t n) {
+    int depth = 0;
+    while (((int64_t)2 << (depth + 1)) - 1 <= n) {
+        ++depth;
+    }
+    // a full tree of depth d has 2^(d+1) - 1 nodes.
+    int64_t nodes = ((int64_t)1 << (depth + 1)) - 1;
+    Result r;
+    r.latency.resize(nodes);
+    Latch done(nodes);
+    Tree<Pool> tree;
+    tree.pool = &pool;
+    tree.done = &done;
+    tree.latency = r.latency.data();
+    int64_t start = nowNs();
+    tree.spawn(depth);
+    done.wait();
+    r.ops = nodes;
+    r.seconds = (nowNs() - start) / 1e9;
+    return r;
+}
+
+template<typename Pool>
+static Result
+benchPriority(Pool &pool, int64_t n) {
+    Result r;
+    std::vector<int64_t> latency(n, -1);
+    Latch done(n);
+    int64_t *slots = latency.data();
+    int64_t start = nowNs();
+    for (int64_t i = 0; i < n; ++i) {
+        bool high = i % 4 == 0;
+        int64_t submitted = high ? nowNs() : 0;
+        pool.submit(high ? kPriorityHigh : kPriorityLow, [slots, i, submitted, &done] {
+            if (submitted) {
+                slots[i] = nowNs() - submitted;
+            }
+            done.arrive();
+        });
+    }
+    done.wait();
+    r.ops = n;
+    r.seconds = (nowNs() - start) / 1e9;
+    for (int64_t l : latency) {
+        if (l >= 0) {
+            r.latency.push_back(l);
+        }
+    }
+    return r;
+}
+
+template<typename Pool>
+static Result
+benchProducers(Pool &pool, int64_t n, int threads) {
+    const int producers = threads * 4;
+    const int64_t each = n / producers > 0 ? n / producers : 1;
+    Result r;
+    r.latency.resize(each * producers);
+    Latch done(each * producers);
+    int64_t *latency = r.latency.data();
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (int p = 0; p < producers; ++p) {
+        workers.emplace_back([&, p] {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (int64_t i = p * each; i < (p + 1) * each; ++i) {
+                int64_t submitted = nowNs();
+                pool.submit([latency, i, submitted, &done] {
+                    latency[i] = nowNs() - submitted;
+                    done.arrive();
+                });
+            }
+        });
+    }
+    int64_t start = nowNs();
+    go.store(true, std::memory_order_release);
+    done.wait();
+    r.seconds = (nowNs() - start) / 1e9;
+    for (auto &t : workers) {
+        t.join();
+    }
+    r.ops = each * producers;
+    return r;
+}
+
+template<typename Pool>
+static void
+runScenarios(const std::string &queue, int threads, ScheduleMode mode, const Config &config, bool &first) {
+    for (auto &scenario : config.scenarios) {
+        Result r;
+        {
+            // a fresh pool per scenario, so one cannot warm up the next.
+            Pool pool(threads, mode);
+            if (scenario == "empty") {
+                r = benchEmpty(pool, config.tasks);
+            } else if (scenario == "fanout") {
+                r = benchFanout(pool, config.tasks);
+            } else if (scenario == "nested") {
+                r = benchNested(pool, config.tasks);
+            } else if (scenario == "priority") {
+                r = benchPriority(pool, config.tasks);
+            } else if (scenario == "producers") {
+                r = benchProducers(pool, config.tasks, threads);
+            } else {
+                fprintf(stderr, "unknown scenario %s\n", scenario.c_str());
+                exit(1);
+            }
+        }
+        r.scenario = scenario;
+        r.queue = queue;
+        r.threads = threads;
+        report(r, config, first);
+        first = false;
+    }
+}
+
+static std::vector<std::string>
+split(const std::string &list) {
+    std::vector<std::string> items;
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > pos) {
+            items.push_back(list.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+    return items;
+}
+
+static void
+usage() {
+    fprintf(stderr, "usage: bench [--threads 1,2,4,8] [--tasks N] [--scenario empty,fanout,nested,priority,producers]\n"
+                    "             [--queue shared,steal,ring] [--format text|csv|json]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Config config;
+    config.scenarios = split("empty,fanout,nested,priority,producers");
+    config.queues = split("shared,steal,ring");
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            usage();
+        }
+        std::string arg = argv[i], value = argv[++i];
+        if (arg == "--threads") {
+            for (auto &n : split(value)) {
+                config.threads.push_back(atoi(n.c_str()));
+            }
+        } else if (arg == "--tasks") {
+            config.tasks = atoll(value.c_str());
+        } else if (arg == "--scenario") {
+            config.scenarios = split(value);
+        } else if (arg == "--queue") {
+            config.queues = split(value);
+        } else if (arg == "--format") {
+            config.format = value;
+        } else {
+            usage();
+        }
+    }
+    if (config.threads.empty()) {
+        int n = (int)std::thread::hardware_concurrency();
+        for (int t = 1; t < n; t *= 2) {
+            config.threads.push_back(t);
+        }
+        config.threads.push_back(n > 0 ? n : 1);
+    }
+    if (config.tasks < 1) {
+        usage();
+    }
+
+    bool first = true;
+    for (int threads : config.threads) {
+        for (auto &queue : config.queues) {
+            if (queue == "shared") {
+                runScenarios<ThreadPool>(queue, threads, ScheduleMode::Shared, config, first);
+            } else if (queue == "steal") {
+                runScenarios<ThreadPool>(queue, threads, ScheduleMode::WorkStealing, config, first);
+            } else if (queue == "ring") {
+                runScenarios<BasicThreadPool<RingQueue>>(queue, threads, ScheduleMode::Shared, config, first);
+            } else {
+                usage();
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+
+#include "binaryLog.h"
+
+namespace binary_log {
+
+template<typename T>
+static const char *get(const char *p, T &value) {
+    memcpy(&value, p, sizeof(value));
+    return p + sizeof(value);
+}
+
+// write one argument, return where the next one starts.
+static const char *
+decodeArg(std::ostream &ost, const char *p) {
+    ArgTag tag = (ArgTag)*p++;
+    switch (tag) {
+    case kInt: {
+        int64_t value;
+        p = get(p, value);
+        ost << value;
+        break;
+    }
+    case kUint: {
+        uint64_t value;
+        p = get(p, value);
+        ost << value;
+        break;
+    }
+    case kDouble: {
+        double value;
+        p = get(p, value);
+        ost << value;
+        break;
+    }
+    case kBool:
+        ost << (*p++ ? "true" : "false");
+        break;
+    case kChar:
+        ost << *p++;
+        break;
+    case kString: {
+        uint32_t bytes;
+        p = get(p, bytes);
+        ost.write(p, bytes);
+        p += bytes;
+        break;
+    }
+    case kPointer: {
+        uint64_t value;
+        p = get(p, value);
+        ost << "0x" << std::hex << value << std::dec;
+        break;
+    }
+    }
+    return p;
+}
+
+void
+decode(std::ostream &ost, const char *format, const char *args, const char *end) {
+    const char *text = format;
+    for (const char *p = format; *p; ++p) {
+        if (p[0] != '{' || p[1] != '}' || args >= end) {
+            continue;
+        }
+        ost.write(text, p - text);
+        args = decodeArg(ost, args);
+        text = ++p + 1;
+    }
+    ost << text;
+}
+
+}// namespace binary_log
+
+// rings of all threads, closed ones until they are drained.
+static std::mutex s_ringsMutex;
+static std::vector<BinaryLogRing::Ptr> s_rings;
+
+static thread_local BinaryLogRing *t_ring = nullptr;
+static thread_local bool t_ringClosed = false;
+
+namespace {
+struct BinaryLogRingCloser {
+    BinaryLogRing::Ptr ring;
+    ~BinaryLogRingCloser() {
+        ring->close();
+        t_ring = nullptr;
+        t_ringClosed = true;
+    }
+};
+}// namespace
+
+BinaryLogRing::BinaryLogRing() :
+    _dropped(0),
+    _published(0),
+    _consumed(0),
+    _closed(false),
+    _data(new char[kCapacity]) {
+}
+
+BinaryLogRing *
+BinaryLogRing::local() {
+    if (!t_ring && !t_ringClosed) {
+        static thread_local BinaryLogRingCloser closer;
+        closer.ring = std::make_shared<BinaryLogRing>();
+        {
+            std::lock_guard<std::mutex> lock(s_ringsMutex);
+            s_rings.push_back(closer.ring);
+        }
+        t_ring = closer.ring.get();
+    }
+    return t_ring;
+}
+
+//BinaryLogWriter
+BinaryLogWriter::BinaryLogWriter(Logger &logger) :
+    _exit(false),
+    _logger(logger) {
+    _thread = std::make_shared<std::thread>([this]() {this->run(); });
+}
+
+BinaryLogWriter::~BinaryLogWriter() {
+    _exit = true;
+    _thread->join();
+    drainAll();
+}
+
+/*
+*Summary: poll the rings, sleep a little when all are empty.
+*        Producers never wake the writer, a log call stays a few
+*        stores; records wait at most about a millisecond.
+*/
+void
+BinaryLogWriter::run() {
+    while (!_exit) {
+        if (drainAll() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+// Decode everything published so far, return the count. Rings of exited
+// threads are dropped once empty. s_ringsMutex is only held to copy the
+// list, threads starting to log do not wait for the formatting.
+size_t
+BinaryLogWriter::drainAll() {
+    {
+        std::lock_guard<std::mutex> lock(s_ringsMutex);
+        _rings = s_rings;
+    }
+    size_t n = 0;
+    bool drainedClosed = false;
+    for (auto &ptr : _rings) {
+        BinaryLogRing &ring = *ptr;
+        // read before draining: what a closed ring published is all there is.
+        bool closed = ring.closed();
+        n += ring.drain([this](const binary_log::RecordHeader &header, const char *args, const char *end) {
+            const BinaryLogSite &site = *header.site;
+            LogContextPtr ctx = LogContext::create(site.level, site.file, site.function, site.line);
+            ctx->_tv = header.tv;
+            binary_log::decode(*ctx, site.format, args, end);
+            _logger.write(std::move(ctx));
+        });
+        uint64_t dropped = ring.dropped();
+        if (dropped != ring._reported) {
+            LogContextCapturer(_logger, LWarn, __FILE__, __FUNCTION__, __LINE__)
+                << dropped - ring._reported << " binary log records dropped, ring full";
+            ring._reported = dropped;
+        }
+        // keep only the rings to drop from s_rings.
+        if (closed) {
+            drainedClosed = true;
+        }
+        else {
+            ptr.reset();
+        }
+    }
+    if (drainedClosed) {
+        std::lock_guard<std::mutex> lock(s_ringsMutex);
+        s_rings.erase(std::remove_if(s_rings.begin(), s_rings.end(), [this](const BinaryLogRing::Ptr &ring) {
+            return std::find(_rings.begin(), _rings.end(), ring) != _rings.end();
+        }), s_rings.end());
+    }
+    _rings.clear();
+    return n;
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <type_traits>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif // !_WIN32
+
+#include "logger.h"
+#include "ringQueue.h"
+
+// Binary logging: formatting is deferred to a BinaryLogWriter thread.
+//
+//   BinaryLogWriter writer;     // decodes into g_defaultLogger's channels
+//   InfoB("sent {} bytes to {} in {} ms", n, host, ms);
+//
+// Every call site has a static BinaryLogSite with its level, place and
+// format, built at compile time. A call copies the site address, the
+// time and the raw arguments (numbers, pointers, string bytes) into a
+// ring of the calling thread; there is no lock, no allocation and no
+// formatting on the calling thread. The writer turns records into text,
+// one "{}" per argument, and hands them to Logger::write, so they meet
+// an AsyncLogWriter and the channels like any other line. Without an
+// AsyncLogWriter the channels are also written from the BinaryLogWriter
+// thread, next to the threads logging with TraceL and friends.
+// When a ring is full the record is dropped and counted, the writer
+// reports how many were lost.
+
+struct BinaryLogSite {
+    LogLevel level;
+    const char *file;
+    const char *function;
+    int line;
+    const char *format;
+};
+
+namespace binary_log {
+
+enum ArgTag : uint8_t {
+    kInt,
+    kUint,
+    kDouble,
+    kBool,
+    kChar,
+    kString,
+    kPointer,
+};
+
+// what precedes the arguments of every record.
+struct RecordHeader {
+    // nullptr: the rest of the ring up to its end is skipped.
+    const BinaryLogSite *site;
+    struct timeval tv;
+    uint32_t size;
+};
+
+// strings longer than this are cut.
+static const uint32_t kMaxStringBytes = 4096;
+
+template<typename T>
+struct IsInteger : std::integral_constant<bool,
+    (std::is_integral<T>::value || std::is_enum<T>::value) &&
+    !std::is_same<T, bool>::value && !std::is_same<T, char>::value> {};
+
+// an enum is as signed as its underlying type.
+template<typename T, bool = std::is_enum<T>::value>
+struct IsSigned : std::is_signed<T> {};
+
+template<typename T>
+struct IsSigned<T, true> : std::is_signed<typename std::underlying_type<T>::type> {};
+
+// a string argument, measured once for both argSize() and putArg().
+struct StringArg {
+    const char *data;
+    uint32_t bytes;
+};
+
+// a null string is written as an empty one.
+inline StringArg toArg(const char *s) {
+    if (!s)
+        return StringArg{ "", 0 };
+    return StringArg{ s, (uint32_t)std::min<size_t>(strlen(s), kMaxStringBytes) };
+}
+
+inline StringArg toArg(char *s) {
+    return toArg((const char *)s);
+}
+
+inline StringArg toArg(const std::string &s) {
+    return StringArg{ s.data(), (uint32_t)std::min<size_t>(s.size(), kMaxStringBytes) };
+}
+
+// anything else is written as it is.
+template<typename T>
+const T &toArg(const T &v) {
+    return v;
+}
+
+template<typename T>
+typename std::enable_if<IsInteger<T>::value, size_t>::type
+argSize(const T &) {
+    return 1 + sizeof(uint64_t);
+}
+
+template<typename T>
+typename std::enable_if<std::is_floating_point<T>::value, size_t>::type
+argSize(const T &) {
+    return 1 + sizeof(double);
+}
+
+inline size_t argSize(bool) { return 2; }
+inline size_t argSize(char) { return 2; }
+
+inline size_t argSize(const StringArg &s) {
+    return 1 + sizeof(uint32_t) + s.bytes;
+}
+
+inline size_t argSize(const void *) {
+    return 1 + sizeof(uint64_t);
+}
+
+inline size_t argSize(std::nullptr_t) {
+    return 1 + sizeof(uint64_t);
+}
+
+inline char *put(char *p, const void *data, size_t size) {
+    memcpy(p, data, size);
+    return p + size;
+}
+
+inline char *putTag(char *p, ArgTag tag) {
+    *p = (char)tag;
+    return p + 1;
+}
+
+template<typename T>
+typename std::enable_if<IsInteger<T>::value && IsSigned<T>::value, char*>::type
+putArg(char *p, const T &v) {
+    int64_t value = (int64_t)v;
+    return put(putTag(p, kInt), &value, sizeof(value));
+}
+
+template<typename T>
+typename std::enable_if<IsInteger<T>::value && !IsSigned<T>::value, char*>::type
+putArg(char *p, const T &v) {
+    uint64_t value = (uint64_t)v;
+    return put(putTag(p, kUint), &value, sizeof(value));
+}
+
+template<typename T>
+typename std::enable_if<std::is_floating_point<T>::value, char*>::type
+putArg(char *p, const T &v) {
+    double value = (double)v;
+    return put(putTag(p, kDouble), &value, sizeof(value));
+}
+
+inline char *putArg(char *p, bool v) {
+    p = putTag(p, kBool);
+    *p = v ? 1 : 0;
+    return p + 1;
+}
+
+inline char *putArg(char *p, char v) {
+    p = putTag(p, kChar);
+    *p = v;
+    return p + 1;
+}
+
+inline char *putArg(char *p, const StringArg &s) {
+    p = put(putTag(p, kString), &s.bytes, sizeof(s.bytes));
+    return put(p, s.data, s.bytes);
+}
+
+inline char *putArg(char *p, const void *v) {
+    uint64_t value = (uint64_t)(uintptr_t)v;
+    return put(putTag(p, kPointer), &value, sizeof(value));
+}
+
+inline char *putArg(char *p, std::nullptr_t) {
+    return putArg(p, (const void *)nullptr);
+}
+
+inline size_t argsSize() {
+    return 0;
+}
+
+template<typename T, typename... Args>
+size_t argsSize(const T &arg, const Args&... args) {
+    return argSize(arg) + argsSize(args...);
+}
+
+inline char *putArgs(char *p) {
+    return p;
+}
+
+template<typename T, typename... Args>
+char *putArgs(char *p, const T &arg, const Args&... args) {
+    return putArgs(putArg(p, arg), args...);
+}
+
+// write the arguments in [args, end) into ost in place of the "{}" of
+// format; a "{}" with no argument left is written as it is.
+void decode(std::ostream &ost, const char *format, const char *args, const char *end);
+
+}// namespace binary_log
+
+// Single-producer/single-consumer byte ring of one thread. Records are
+// contiguous: one that does not fit before the end of the ring starts
+// over at its beginning.
+class BinaryLogRing : public noncopyable {
+public:
+    friend class BinaryLogWriter;
+
+    typedef std::shared_ptr<BinaryLogRing> Ptr;
+
+    static const size_t kCapacity = 256 * 1024;
+
+    BinaryLogRing();
+
+    // this thread's ring, registered on first use; nullptr while the
+    // thread's thread_locals are torn down.
+    static BinaryLogRing *local();
+
+    // room for a record of size bytes, nullptr (and counted as dropped)
+    // if the ring is full. Producer only.
+    char *reserve(size_t size) {
+        size_t pos = _tail & (kCapacity - 1);
+        size_t skip = kCapacity - pos < size ? kCapacity - pos : 0;
+        if (size > kCapacity / 2 || !hasRoom(skip + size)) {
+            _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        if (skip >= sizeof(binary_log::RecordHeader)) {
+            binary_log::RecordHeader pad;
+            pad.site = nullptr;
+            memcpy(&_data[pos], &pad, sizeof(pad));
+        }
+        _reserved = _tail + skip + size;
+        return &_data[(_tail + skip) & (kCapacity - 1)];
+    }
+
+    // publish the record of the last reserve(). Producer only.
+    void commit() {
+        _tail = _reserved;
+        _published.store(_tail, std::memory_order_release);
+    }
+
+    // decode every published record with fn(header, args, end), return
+    // the count. Consumer only.
+    template<typename F>
+    size_t drain(F fn);
+
+    uint64_t dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    // the thread has exited, nothing more will be published.
+    bool closed() const {
+        return _closed.load(std::memory_order_acquire);
+    }
+    void close() {
+        _closed.store(true, std::memory_order_release);
+    }
+private:
+    bool hasRoom(size_t size) {
+        if (kCapacity - (_tail - _headCache) >= size)
+            return true;
+        _headCache = _consumed.load(std::memory_order_acquire);
+        return kCapacity - (_tail - _headCache) >= size;
+    }
+private:
+    // producer side
+    size_t _tail = 0;
+    size_t _reserved = 0;
+    size_t _headCache = 0;
+    std::atomic<uint64_t> _dropped;
+    char _pad0[multi_thread::kCacheLineSize];
+    std::atomic<size_t> _published;
+    char _pad1[multi_thread::kCacheLineSize];
+    // consumer side
+    std::atomic<size_t> _consumed;
+    std::atomic<bool> _closed;
+    // dropped records the writer has reported.
+    uint64_t _reported = 0;
+    char _pad2[multi_thread::kCacheLineSize];
+    std::unique_ptr<char[]> _data;
+};
+
+template<typename F>
+size_t
+BinaryLogRing::drain(F fn) {
+    size_t head = _consumed.load(std::memory_order_relaxed);
+    size_t tail = _published.load(std::memory_order_acquire);
+    size_t n = 0;
+    while (head != tail) {
+        size_t pos = head & (kCapacity - 1);
+        size_t room = kCapacity - pos;
+        binary_log::RecordHeader header;
+        if (room >= sizeof(header)) {
+            memcpy(&header, &_data[pos], sizeof(header));
+        }
+        if (room < sizeof(header) || !header.site) {
+            head += room;
+            continue;
+        }
+        const char *args = &_data[pos] + sizeof(header);
+        fn(header, args, &_data[pos] + header.size);
+        head += header.size;
+        ++n;
+    }
+    _consumed.store(head, std::memory_order_release);
+    return n;
+}
+
+namespace binary_log {
+
+// args as given by toArg().
+template<typename... Args>
+void write(const BinaryLogSite &site, const Args&... args) {
+    BinaryLogRing *ring = BinaryLogRing::local();
+    if (!ring) {
+        return;
+    }
+    binary_log::RecordHeader header;
+    header.site = &site;
+    header.size = (uint32_t)(sizeof(header) + binary_log::argsSize(args...));
+    char *p = ring->reserve(header.size);
+    if (!p) {
+        return;
+    }
+    gettimeofday(&header.tv, NULL);
+    binary_log::putArgs(binary_log::put(p, &header, sizeof(header)), args...);
+    ring->commit();
+}
+
+}// namespace binary_log
+
+template<typename... Args>
+void binaryLog(const BinaryLogSite &site, const Args&... args) {
+    binary_log::write(site, binary_log::toArg(args)...);
+}
+
+// Drains the rings of all threads into a Logger on its own thread.
+// Only one may exist at a time.
+class BinaryLogWriter : public noncopyable {
+public:
+    BinaryLogWriter(Logger &logger = Logger::Instance());
+    ~BinaryLogWriter();
+private:
+    void run();
+    size_t drainAll();
+private:
+    std::atomic<bool> _exit;
+    // s_rings as of the current drainAll(), kept for its capacity.
+    std::vector<BinaryLogRing::Ptr> _rings;
+    std::shared_ptr<std::thread> _thread;
+    Logger &_logger;
+};
+
+// Arguments are only evaluated when the level is enabled, as for WriteL.
+#define WriteB(level, format, ...) \
+    do { \
+        if ((level) >= LOG_MIN_LEVEL && g_defaultLogger->enabled(level)) { \
+            static const BinaryLogSite s_binaryLogSite = { level, __FILE__, __FUNCTION__, __LINE__, format }; \
+            binaryLog(s_binaryLogSite, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define TraceB(format, ...) WriteB(LTrace, format, ##__VA_ARGS__)
+#define DebugB(format, ...) WriteB(LDebug, format, ##__VA_ARGS__)
+#define InfoB(format, ...) WriteB(LInfo, format, ##__VA_ARGS__)
+#define WarnB(format, ...) WriteB(LWarn, format, ##__VA_ARGS__)
+#define ErrorB(format, ...) WriteB(LError, format, ##__VA_ARGS__)
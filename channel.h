@@ -0,0 +1,721 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+#include <condition_variable>
+
+#include "task.h"
+#include "future.h"
+#include "ringQueue.h"
+
+namespace multi_thread {
+
+// Typed bounded channel between the stages of a pipeline:
+//
+//   Channel<Frame> frames(256);
+//   std::thread decoder([&] { Frame f; while (frames.recv(f)) decode(std::move(f)); });
+//   for (...) frames.send(std::move(frame));
+//   frames.close();      // recv() returns false once the rest is taken
+//
+// Elements live in a lock-free ring: RingQueue for Mpmc, a ring with one
+// index per side for Spsc. A send or recv that does not have to wait
+// is a few atomics and never locks; the mutex is only taken to park on a
+// full or empty channel and by the other side when it sees someone
+// parked. Elements may be move-only, they must be default constructible
+// and move assignable. Instead of a receiving thread a channel can have
+// a consumer running on an Executor (consume()), and Select receives
+// from several channels at once.
+enum class ChannelMode {
+    Mpmc,   // any number of senders and receivers
+    Spsc    // one sending and one receiving thread at a time
+};
+
+namespace detail {
+
+// Bounded single-producer/single-consumer ring. Each side keeps a copy of
+// the other side's index and only reloads it when the ring looks full
+// (empty), so a push or pop usually touches no line the other side writes.
+template<typename T>
+class SpscRing {
+public:
+    // capacity is rounded up to a power of two.
+    explicit SpscRing(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+        _mask = n - 1;
+        _cells.reset(new T[n]);
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // v is only moved from when there is room.
+    template<typename U>
+    bool tryPush(U&& v) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _headCache > _mask) {
+            _headCache = _head.load(std::memory_order_acquire);
+            if (tail - _headCache > _mask)
+                return false;
+        }
+        _cells[tail & _mask] = std::forward<U>(v);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& v) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tailCache) {
+            _tailCache = _tail.load(std::memory_order_acquire);
+            if (head == _tailCache)
+                return false;
+        }
+        v = std::move(_cells[head & _mask]);
+        _cells[head & _mask] = T();
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // approximate unless called by one of the two sides.
+    int size() const {
+        size_t head = _head.load(std::memory_order_acquire);
+        size_t tail = _tail.load(std::memory_order_acquire);
+        return tail > head ? (int)(tail - head) : 0;
+    }
+
+    size_t capacity() const {
+        return _mask + 1;
+    }
+private:
+    char _pad0[kCacheLineSize];
+    // consumer's line.
+    std::atomic<size_t> _head{0};
+    size_t _tailCache = 0;
+    char _pad1[kCacheLineSize - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    // producer's line.
+    std::atomic<size_t> _tail{0};
+    size_t _headCache = 0;
+    char _pad2[kCacheLineSize - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    std::unique_ptr<T[]> _cells;
+    size_t _mask;
+};
+
+template<typename T, ChannelMode Mode>
+struct ChannelRing {
+    typedef RingQueue<T> type;
+};
+
+template<typename T>
+struct ChannelRing<T, ChannelMode::Spsc> {
+    typedef SpscRing<T> type;
+};
+
+// what a parked Select sleeps on, signalled by each of its channels.
+struct SelectWaiter {
+    std::mutex mtx;
+    std::condition_variable cond;
+    bool signalled = false;
+
+    void signal() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            signalled = true;
+        }
+        cond.notify_one();
+    }
+};
+
+// consume()'s side of a channel, woken like a parked receiver.
+class ChannelConsumer {
+public:
+    virtual ~ChannelConsumer() {}
+    virtual void signal() = 0;
+    // wait until no drain task of it is queued or running.
+    virtual void join() = 0;
+};
+
+}// namespace detail
+
+
+// Closing, parking and waking, the part of a channel that does not
+// depend on the element type.
+class ChannelBase {
+public:
+    ChannelBase() {}
+
+    ChannelBase(const ChannelBase&) = delete;
+    ChannelBase& operator=(const ChannelBase&) = delete;
+
+    // no more sends: they return false from now on, receivers get what is
+    // left and then see the end. Blocked senders give up. Idempotent.
+    void close() {
+        _state.fetch_or(kClosed, std::memory_order_seq_cst);
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            for (detail::SelectWaiter* w : _selects) {
+                w->signal();
+            }
+        }
+        _notEmpty.notify_all();
+        _notFull.notify_all();
+        if (detail::ChannelConsumer* consumer = _consumer.load(std::memory_order_acquire))
+            consumer->signal();
+    }
+
+    bool closed() const {
+        return (_state.load(std::memory_order_acquire) & kClosed) != 0;
+    }
+
+    // Select's parking, see there.
+    void attach(detail::SelectWaiter* w) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _selects.push_back(w);
+        _recvWaiting.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    void detach(detail::SelectWaiter* w) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _selects.erase(std::find(_selects.begin(), _selects.end(), w));
+        _recvWaiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // closed and no send in flight: what is queued now is all there will be.
+    bool finished() const {
+        return _state.load(std::memory_order_seq_cst) == kClosed;
+    }
+protected:
+    static const size_t kAll = ~(size_t)0;
+
+    // count a send in flight, so that receivers can tell when the end
+    // has come. false (and nothing counted) once closed.
+    bool beginSend() {
+        if (_state.fetch_add(kSender, std::memory_order_seq_cst) & kClosed) {
+            endSend(0);
+            return false;
+        }
+        return true;
+    }
+
+    // n elements went in.
+    void endSend(size_t n) {
+        _state.fetch_sub(kSender, std::memory_order_seq_cst);
+        // receivers waiting for the end need to look again.
+        if (closed())
+            wakeReceivers(kAll);
+        else
+            wakeReceivers(n);
+    }
+
+    // n elements went in: wake up to n parked receivers, every Select and
+    // the consumer. Only locks when somebody is parked.
+    void wakeReceivers(size_t n) {
+        if (n == 0)
+            return;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_recvWaiting.load(std::memory_order_relaxed) > 0) {
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                for (detail::SelectWaiter* w : _selects) {
+                    w->signal();
+                }
+            }
+            if (n == 1)
+                _notEmpty.notify_one();
+            else
+                _notEmpty.notify_all();
+        }
+        if (detail::ChannelConsumer* consumer = _consumer.load(std::memory_order_acquire))
+            consumer->signal();
+    }
+
+    // n elements were taken out.
+    void wakeSenders(size_t n) {
+        if (n == 0)
+            return;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_sendWaiting.load(std::memory_order_relaxed) == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+        }
+        if (n == 1)
+            _notFull.notify_one();
+        else
+            _notFull.notify_all();
+    }
+
+    // park on cond until ready() or deadline, false on timeout.
+    template<typename Pred>
+    bool park(std::condition_variable& cond, std::atomic<int>& waiting, Pred ready,
+              std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        // seq_cst: either the other side sees us waiting, or we see its
+        // change in ready().
+        waiting.fetch_add(1, std::memory_order_seq_cst);
+        bool ok = true;
+        if (deadline == std::chrono::steady_clock::time_point::max())
+            cond.wait(lock, ready);
+        else
+            ok = cond.wait_until(lock, deadline, ready);
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+        return ok;
+    }
+protected:
+    static const uint64_t kClosed = 1;
+    static const uint64_t kSender = 2;
+
+    // kClosed | senders in flight * kSender.
+    std::atomic<uint64_t> _state{0};
+    std::atomic<int> _recvWaiting{0};
+    std::atomic<int> _sendWaiting{0};
+    std::atomic<detail::ChannelConsumer*> _consumer{nullptr};
+    std::mutex _mtx;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+    std::vector<detail::SelectWaiter*> _selects;
+};
+
+
+template<typename T, ChannelMode Mode = ChannelMode::Mpmc>
+class Channel : public ChannelBase {
+public:
+    typedef T value_type;
+
+    // capacity is rounded up to a power of two.
+    explicit Channel(size_t capacity = 1024) : _ring(capacity) {}
+
+    // waits for the consumer's running drain, if any.
+    ~Channel() {
+        if (_consumerOwner)
+            _consumerOwner->join();
+    }
+
+    // block while full; false if the channel is closed, v is not moved
+    // from then.
+    bool send(T&& v) {
+        return sendOne(std::move(v));
+    }
+
+    bool send(const T& v) {
+        return sendOne(v);
+    }
+
+    // false if full or closed.
+    bool try_send(T&& v) {
+        if (!beginSend())
+            return false;
+        bool ok = _ring.tryPush(std::move(v));
+        endSend(ok ? 1 : 0);
+        return ok;
+    }
+
+    // send n elements from first (moved from) in order, blocking for room
+    // as needed. Receivers are woken once per run of elements that fit.
+    // Returns the number sent, less than n only if the channel was closed.
+    template<typename It>
+    size_t send_n(It first, size_t n) {
+        if (!beginSend())
+            return 0;
+        size_t sent = 0;
+        while (sent < n) {
+            size_t run = 0;
+            while (sent + run < n && _ring.tryPush(std::move(*first))) {
+                ++first;
+                ++run;
+            }
+            sent += run;
+            if (sent == n || closed())
+                break;
+            wakeReceivers(run);
+            waitForRoom();
+        }
+        endSend(sent);
+        return sent;
+    }
+
+    // block until an element can be taken; false once the channel is
+    // closed and empty.
+    bool recv(T& v) {
+        return recvUntil(v, std::chrono::steady_clock::time_point::max());
+    }
+
+    // false if nothing could be taken in time, or at the end (closed()
+    // tells which).
+    template<typename Rep, typename Period>
+    bool recv_for(T& v, const std::chrono::duration<Rep, Period>& timeout) {
+        return recvUntil(v, std::chrono::steady_clock::now() + timeout);
+    }
+
+    // never blocks.
+    bool try_recv(T& v) {
+        if (!_ring.tryPop(v))
+            return false;
+        wakeSenders(1);
+        return true;
+    }
+
+    // wait for one element like recv(), then take whatever else is there
+    // up to n in total, writing them to out. Returns the number taken, 0
+    // at the end.
+    template<typename Out>
+    size_t recv_n(Out out, size_t n) {
+        if (n == 0)
+            return 0;
+        T v;
+        if (!recvUntil(v, std::chrono::steady_clock::time_point::max(), false))
+            return 0;
+        *out = std::move(v);
+        ++out;
+        size_t got = 1;
+        while (got < n && _ring.tryPop(v)) {
+            *out = std::move(v);
+            ++out;
+            ++got;
+        }
+        wakeSenders(got);
+        return got;
+    }
+
+    // Hand every element to fn(T&&) on executor instead of receiving:
+    // a drain task is queued when elements arrive and runs up to batch
+    // of them back to back, one drain at a time, so fn sees them in
+    // order and is never run concurrently with itself. The future is
+    // ready once the channel is closed and everything has been consumed,
+    // or has fn's first exception (consuming stops there). Once only;
+    // nobody else may receive from a Spsc channel with a consumer.
+    template<typename F>
+    Future<void> consume(Executor& executor, F&& fn, size_t batch = 64) {
+        std::unique_ptr<Consumer<typename std::decay<F>::type>> consumer(
+            new Consumer<typename std::decay<F>::type>(this, executor, std::forward<F>(fn), batch));
+        Future<void> future = consumer->future();
+        detail::ChannelConsumer* attached = consumer.get();
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_consumerOwner)
+                throw std::logic_error("channel already has a consumer");
+            _consumerOwner = std::move(consumer);
+            _consumer.store(attached, std::memory_order_release);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // elements sent before it was attached.
+        attached->signal();
+        return future;
+    }
+
+    // approximate while others send or receive.
+    int size() const {
+        return _ring.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return _ring.capacity();
+    }
+private:
+    template<typename U>
+    bool sendOne(U&& v) {
+        if (!beginSend())
+            return false;
+        // tryPush leaves v alone when full.
+        while (!_ring.tryPush(std::forward<U>(v))) {
+            if (closed()) {
+                endSend(0);
+                return false;
+            }
+            waitForRoom();
+        }
+        endSend(1);
+        return true;
+    }
+
+    void waitForRoom() {
+        park(_notFull, _sendWaiting, [this] {
+            return (size_t)_ring.size() < _ring.capacity() || closed();
+        }, std::chrono::steady_clock::time_point::max());
+    }
+
+    bool recvUntil(T& v, std::chrono::steady_clock::time_point deadline, bool wake = true) {
+        while (true) {
+            // checked first: if no sender was left, a failed pop is the end.
+            bool last = finished();
+            if (_ring.tryPop(v)) {
+                if (wake)
+                    wakeSenders(1);
+                return true;
+            }
+            if (last)
+                return false;
+            bool ok = park(_notEmpty, _recvWaiting, [this] {
+                return _ring.size() > 0 || finished();
+            }, deadline);
+            if (!ok)
+                return false;
+        }
+    }
+
+    template<typename F>
+    class Consumer : public detail::ChannelConsumer {
+    public:
+        template<typename G>
+        Consumer(Channel* channel, Executor& executor, G&& fn, size_t batch)
+            : _channel(channel), _executor(executor), _fn(std::forward<G>(fn)),
+              _batch(batch > 0 ? batch : 1), _promise(new Promise<void>(&executor)) {
+        }
+
+        Future<void> future() {
+            return _promise->getFuture();
+        }
+
+        // any thread: a send, close() or consume() itself.
+        void signal() override {
+            if (_signals.fetch_add(1, std::memory_order_acq_rel) == 0)
+                schedule();
+        }
+
+        void join() override {
+            while (_signals.load(std::memory_order_acquire) != 0) {
+                if (!_executor.runPendingTask())
+                    std::this_thread::yield();
+            }
+        }
+    private:
+        // the drain queued on the executor. Dropped unrun (pool shutdown)
+        // it ends the consumer with an error instead.
+        class Drain {
+        public:
+            explicit Drain(Consumer* consumer) : _consumer(consumer) {}
+            Drain(Drain&& that) noexcept : _consumer(that._consumer) {
+                that._consumer = nullptr;
+            }
+            Drain(const Drain&) = delete;
+            ~Drain() {
+                if (_consumer)
+                    _consumer->drain(false);
+            }
+            void operator()() {
+                Consumer* consumer = _consumer;
+                _consumer = nullptr;
+                consumer->drain(true);
+            }
+        private:
+            Consumer* _consumer;
+        };
+
+        void schedule() {
+            _executor.execute(Task(Drain(this)));
+        }
+
+        // only one drain runs at a time: _signals stays above zero from
+        // the signal that scheduled it until it retires.
+        void drain(bool run) {
+            size_t seen = _signals.load(std::memory_order_acquire);
+            std::unique_ptr<Promise<void>> done;
+            if (!_finished) {
+                bool end = false;
+                if (!run) {
+                    _error = std::make_exception_ptr(std::runtime_error("channel consumer task dropped"));
+                }
+                else {
+                    bool last = _channel->finished();
+                    size_t n = 0;
+                    T v;
+                    while (n < _batch && _channel->_ring.tryPop(v)) {
+                        ++n;
+                        try {
+                            _fn(std::move(v));
+                        }
+                        catch (...) {
+                            _error = std::current_exception();
+                            break;
+                        }
+                    }
+                    _channel->wakeSenders(n);
+                    if (!_error && n == _batch) {
+                        // maybe more, after the executor's other work.
+                        schedule();
+                        return;
+                    }
+                    end = last;
+                }
+                if (end || _error) {
+                    _finished = true;
+                    done = std::move(_promise);
+                }
+            }
+            // the channel may be destroyed once this is done.
+            if (_signals.fetch_sub(seen, std::memory_order_acq_rel) != seen)
+                schedule();
+            if (done) {
+                if (_error)
+                    done->setException(_error);
+                else
+                    done->setValue();
+            }
+        }
+    private:
+        Channel* _channel;
+        Executor& _executor;
+        F _fn;
+        const size_t _batch;
+        std::atomic<size_t> _signals{0};
+        // drain only.
+        bool _finished = false;
+        std::exception_ptr _error;
+        std::unique_ptr<Promise<void>> _promise;
+    };
+private:
+    typename detail::ChannelRing<T, Mode>::type _ring;
+    std::unique_ptr<detail::ChannelConsumer> _consumerOwner;
+};
+
+
+// Receive from whichever of several channels has an element first:
+//
+//   Select select;
+//   select.recv(orders, [](Order o) { ... })
+//         .recv(quotes, [](Quote q) { ... });
+//   while (select.wait() != Select::kClosed) {}
+//
+// wait() takes one element from a ready channel, runs that channel's
+// handler on it and returns the channel's index (in the order the cases
+// were added). Channels are tried round-robin from the one after the
+// last served, so a busy channel does not starve the others. With
+// nothing ready it parks until one of the channels gets an element or
+// is closed. Handler exceptions propagate out of wait(). Not for use by
+// two threads at once.
+class Select {
+public:
+    static const int kClosed = -1;     // every channel closed and drained
+    static const int kTimeout = -2;
+
+    Select() {}
+
+    Select(const Select&) = delete;
+    Select& operator=(const Select&) = delete;
+
+    template<typename T, ChannelMode Mode, typename F>
+    Select& recv(Channel<T, Mode>& channel, F&& fn) {
+        _cases.emplace_back(new RecvCase<T, Mode, typename std::decay<F>::type>(channel, std::forward<F>(fn)));
+        return *this;
+    }
+
+    int wait() {
+        return waitUntil(std::chrono::steady_clock::time_point::max());
+    }
+
+    template<typename Rep, typename Period>
+    int wait_for(const std::chrono::duration<Rep, Period>& timeout) {
+        return waitUntil(std::chrono::steady_clock::now() + timeout);
+    }
+
+    // run one ready case without waiting, kTimeout if none is ready.
+    int try_once() {
+        return poll();
+    }
+private:
+    struct Case {
+        virtual ~Case() {}
+        virtual ChannelBase& channel() = 0;
+        // take and handle an element if there is one.
+        virtual bool tryRun() = 0;
+    };
+
+    template<typename T, ChannelMode Mode, typename F>
+    struct RecvCase : Case {
+        template<typename G>
+        RecvCase(Channel<T, Mode>& ch, G&& f) : channel_(ch), fn(std::forward<G>(f)) {}
+        ChannelBase& channel() override {
+            return channel_;
+        }
+        bool tryRun() override {
+            if (!channel_.try_recv(value))
+                return false;
+            fn(std::move(value));
+            return true;
+        }
+        Channel<T, Mode>& channel_;
+        F fn;
+        T value;
+    };
+
+    // parked on every channel for as long as it lives.
+    class Attached {
+    public:
+        explicit Attached(Select& select) : _select(select) {
+            for (auto& c : _select._cases) {
+                c->channel().attach(&_select._waiter);
+            }
+        }
+        ~Attached() {
+            for (auto& c : _select._cases) {
+                c->channel().detach(&_select._waiter);
+            }
+        }
+    private:
+        Select& _select;
+    };
+
+    // one round over the cases: the index run, kClosed if every channel
+    // has ended, kTimeout otherwise.
+    int poll() {
+        size_t n = _cases.size();
+        bool ended = true;
+        for (size_t k = 0; k < n; ++k) {
+            size_t i = (_next + k) % n;
+            bool last = _cases[i]->channel().finished();
+            if (_cases[i]->tryRun()) {
+                _next = i + 1;
+                return (int)i;
+            }
+            ended = ended && last;
+        }
+        return ended ? kClosed : kTimeout;
+    }
+
+    int waitUntil(std::chrono::steady_clock::time_point deadline) {
+        while (true) {
+            int r = poll();
+            if (r != kTimeout)
+                return r;
+            {
+                std::lock_guard<std::mutex> lock(_waiter.mtx);
+                _waiter.signalled = false;
+            }
+            {
+                Attached attached(*this);
+                // attached before looking again: whatever arrives from
+                // here on signals the waiter.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                r = poll();
+                if (r != kTimeout)
+                    return r;
+                std::unique_lock<std::mutex> lock(_waiter.mtx);
+                auto signalled = [this] { return _waiter.signalled; };
+                if (deadline == std::chrono::steady_clock::time_point::max())
+                    _waiter.cond.wait(lock, signalled);
+                else if (!_waiter.cond.wait_until(lock, deadline, signalled))
+                    return poll();
+            }
+        }
+    }
+private:
+    std::vector<std::unique_ptr<Case>> _cases;
+    size_t _next = 0;
+    detail::SelectWaiter _waiter;
+};
+
+}// namespace
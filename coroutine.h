@@ -0,0 +1,321 @@
+#pragma once
+#if __cplusplus < 202002L && !(defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#error "coroutine.h needs C++20"
+#endif
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <optional>
+#include <exception>
+#include <coroutine>
+#include <type_traits>
+
+#include "task.h"
+#include "future.h"
+
+namespace multi_thread {
+namespace coro {
+
+// Coroutines on a pool:
+//
+//   coro::Task<int> handle(ThreadPool& pool, Request r) {
+//       co_await pool.schedule();          // now on a worker
+//       int a = co_await parse(r);         // child coroutine
+//       co_return a + 1;
+//   }
+//   Future<int> f = coro::spawn(pool, handle(pool, r));
+//
+// A Task<T> is lazy: it starts when awaited and resumes its awaiter by
+// symmetric transfer when done, so long chains of awaits neither block a
+// thread nor grow the stack, and the awaiter continues on whichever
+// worker finished the child. Frames come from per-thread free lists.
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+// Per-thread free lists of coroutine frames in 64-byte size classes up to
+// 1KB; bigger frames go to the heap directly. A frame freed on another
+// thread joins that thread's list, as with futures' shared states.
+class FrameAllocator {
+public:
+    static void* allocate(size_t n) {
+        size_t c = sizeClass(n);
+        if (c >= kClasses)
+            return ::operator new(n);
+        Lists& lists = freeLists();
+        if (Node* node = lists.head[c]) {
+            lists.head[c] = node->next;
+            --lists.count[c];
+            return node;
+        }
+        return ::operator new((c + 1) * kGranule);
+    }
+
+    static void deallocate(void* p, size_t n) {
+        size_t c = sizeClass(n);
+        Lists& lists = freeLists();
+        if (c >= kClasses || lists.count[c] >= kMaxFree) {
+            ::operator delete(p);
+            return;
+        }
+        Node* node = static_cast<Node*>(p);
+        node->next = lists.head[c];
+        lists.head[c] = node;
+        ++lists.count[c];
+    }
+private:
+    static const size_t kGranule = 64;
+    static const size_t kClasses = 16;
+    static const int kMaxFree = 64;
+
+    struct Node {
+        Node* next;
+    };
+    struct Lists {
+        Node* head[kClasses] = {};
+        int count[kClasses] = {};
+        ~Lists() {
+            for (Node* node : head) {
+                while (node) {
+                    Node* next = node->next;
+                    ::operator delete(node);
+                    node = next;
+                }
+            }
+        }
+    };
+
+    static size_t sizeClass(size_t n) {
+        return (n + kGranule - 1) / kGranule - 1;
+    }
+
+    static Lists& freeLists() {
+        static thread_local Lists lists;
+        return lists;
+    }
+};
+
+// final suspend point: hand the thread to the awaiting coroutine.
+struct FinalAwaiter {
+    bool await_ready() const noexcept {
+        return false;
+    }
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+        std::coroutine_handle<> next = h.promise().continuation();
+        return next ? next : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+class PromiseBase {
+public:
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+    FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+    void unhandled_exception() noexcept {
+        _error = std::current_exception();
+    }
+
+    void setContinuation(std::coroutine_handle<> h) {
+        _continuation = h;
+    }
+    std::coroutine_handle<> continuation() const {
+        return _continuation;
+    }
+
+    static void* operator new(size_t n) {
+        return FrameAllocator::allocate(n);
+    }
+    static void operator delete(void* p, size_t n) {
+        FrameAllocator::deallocate(p, n);
+    }
+protected:
+    void rethrow() {
+        if (_error)
+            std::rethrow_exception(_error);
+    }
+private:
+    std::coroutine_handle<> _continuation;
+    std::exception_ptr _error;
+};
+
+template<typename T>
+class TaskPromise : public PromiseBase {
+public:
+    Task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value(U&& value) {
+        _value.emplace(std::forward<U>(value));
+    }
+
+    T result() {
+        rethrow();
+        return std::move(*_value);
+    }
+private:
+    std::optional<T> _value;
+};
+
+template<>
+class TaskPromise<void> : public PromiseBase {
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() {}
+
+    void result() {
+        rethrow();
+    }
+};
+
+}// namespace detail
+
+
+template<typename T>
+class [[nodiscard]] Task {
+public:
+    typedef detail::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    Task() noexcept : _handle(nullptr) {}
+    explicit Task(Handle h) noexcept : _handle(h) {}
+
+    Task(Task&& that) noexcept : _handle(std::exchange(that._handle, nullptr)) {}
+    Task& operator=(Task&& that) noexcept {
+        if (this != &that) {
+            if (_handle)
+                _handle.destroy();
+            _handle = std::exchange(that._handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    bool valid() const {
+        return (bool)_handle;
+    }
+
+    // start the task (or take its result if already done) and continue
+    // once it finishes; its exception is rethrown here.
+    auto operator co_await() const noexcept {
+        struct Awaiter {
+            Handle h;
+            bool await_ready() const noexcept {
+                return h.done();
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                h.promise().setContinuation(awaiting);
+                return h;
+            }
+            T await_resume() {
+                return h.promise().result();
+            }
+        };
+        return Awaiter{ _handle };
+    }
+private:
+    Handle _handle;
+};
+
+namespace detail {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// eager coroutine that frees itself when done, the root of spawn().
+struct Detached {
+    struct promise_type : PromiseBase {
+        Detached get_return_object() const noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() const noexcept {
+            return {};
+        }
+        void return_void() const noexcept {}
+    };
+};
+
+// as ScheduleAwaiter, but a frame the executor drops unrun is destroyed,
+// which breaks spawn()'s promise instead of leaving its future waiting.
+class StartAwaiter {
+public:
+    explicit StartAwaiter(Executor& executor) : _executor(executor) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        _executor.execute(multi_thread::Task(Resume(h)));
+    }
+    void await_resume() const noexcept {}
+private:
+    class Resume {
+    public:
+        explicit Resume(std::coroutine_handle<> h) : _h(h) {}
+        Resume(Resume&& that) noexcept : _h(std::exchange(that._h, nullptr)) {}
+        Resume(const Resume&) = delete;
+        ~Resume() {
+            if (_h)
+                _h.destroy();
+        }
+        void operator()() {
+            std::exchange(_h, nullptr).resume();
+        }
+    private:
+        std::coroutine_handle<> _h;
+    };
+
+    Executor& _executor;
+};
+
+template<typename T>
+Detached drive(Executor& executor, Task<T> task, Promise<T> promise) {
+    co_await StartAwaiter(executor);
+    try {
+        if constexpr (std::is_void<T>::value) {
+            co_await task;
+            promise.setValue();
+        }
+        else {
+            promise.setValue(co_await task);
+        }
+    }
+    catch (...) {
+        promise.setException(std::current_exception());
+    }
+}
+
+}// namespace detail
+
+// run task on executor, the Future gets its result or exception.
+template<typename T>
+Future<T> spawn(Executor& executor, Task<T> task) {
+    Promise<T> promise(&executor);
+    Future<T> future = promise.getFuture();
+    detail::drive(executor, std::move(task), std::move(promise));
+    return future;
+}
+
+}// namespace coro
+}// namespace
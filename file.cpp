@@ -7,7 +7,10 @@
 #pragma warning(disable:4996) 
 #else
 #include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #endif // _WIN32
+#include <string.h>
 
 
 #ifndef _WIN32
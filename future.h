@@ -0,0 +1,422 @@
+#pragma once
+#include <new>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <condition_variable>
+
+#include "task.h"
+
+namespace multi_thread {
+
+template<typename T> class Future;
+template<typename T> class Promise;
+
+namespace detail {
+
+// Recycles shared state blocks of one size through a per-thread free list,
+// so a future/promise pair does not cost a heap allocation in steady state.
+template<typename State>
+class StatePool {
+public:
+    static void* allocate() {
+        FreeList& list = freeList();
+        if (list.head) {
+            Node* node = list.head;
+            list.head = node->next;
+            --list.count;
+            return node;
+        }
+        return ::operator new(sizeof(Block));
+    }
+
+    static void deallocate(void* p) {
+        FreeList& list = freeList();
+        if (list.count >= kMaxFree) {
+            ::operator delete(p);
+            return;
+        }
+        Node* node = static_cast<Node*>(p);
+        node->next = list.head;
+        list.head = node;
+        ++list.count;
+    }
+private:
+    static const int kMaxFree = 256;
+
+    struct Node {
+        Node* next;
+    };
+    union Block {
+        Node node;
+        typename std::aligned_storage<sizeof(State), alignof(State)>::type state;
+    };
+    struct FreeList {
+        Node* head = nullptr;
+        int count = 0;
+        ~FreeList() {
+            while (head) {
+                Node* next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    };
+
+    static FreeList& freeList() {
+        static thread_local FreeList list;
+        return list;
+    }
+};
+
+// Value slot of a shared state, void has none.
+template<typename T>
+class ValueSlot {
+public:
+    ~ValueSlot() {
+        if (_has)
+            reinterpret_cast<T*>(&_value)->~T();
+    }
+    template<typename... A>
+    void set(A&&... a) {
+        ::new (&_value) T(std::forward<A>(a)...);
+        _has = true;
+    }
+    T take() {
+        return std::move(*reinterpret_cast<T*>(&_value));
+    }
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _value;
+    bool _has = false;
+};
+
+template<>
+class ValueSlot<void> {
+public:
+    void set() {}
+    void take() {}
+};
+
+template<typename T>
+class SharedState {
+public:
+    static SharedState* create(Executor* executor) {
+        return ::new (StatePool<SharedState>::allocate()) SharedState(executor);
+    }
+
+    void addRef() {
+        _refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            this->~SharedState();
+            StatePool<SharedState>::deallocate(this);
+        }
+    }
+
+    bool ready() const {
+        return _ready.load(std::memory_order_acquire);
+    }
+
+    template<typename... A>
+    void setValue(A&&... a) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (_ready.load(std::memory_order_relaxed))
+            throw std::logic_error("promise already satisfied");
+        _value.set(std::forward<A>(a)...);
+        complete(lock);
+    }
+
+    void setException(std::exception_ptr e) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (_ready.load(std::memory_order_relaxed))
+            throw std::logic_error("promise already satisfied");
+        _exception = e;
+        complete(lock);
+    }
+
+    // wait until ready, running the executor's queued tasks meanwhile so a
+    // worker waiting on its own pool keeps the pool making progress.
+    void wait() {
+        while (!ready()) {
+            if (_executor && _executor->runPendingTask())
+                continue;
+            std::unique_lock<std::mutex> lock(_mtx);
+            ++_waiters;
+            // timed, new work may show up in the pool while we sleep.
+            _cond.wait_for(lock, std::chrono::milliseconds(1), [this] { return ready(); });
+            --_waiters;
+        }
+    }
+
+    template<typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        ++_waiters;
+        bool ok = _cond.wait_for(lock, timeout, [this] { return ready(); });
+        --_waiters;
+        return ok;
+    }
+
+    // rethrow the stored exception or move the value out.
+    T take() {
+        if (_exception)
+            std::rethrow_exception(_exception);
+        return _value.take();
+    }
+
+    std::exception_ptr exception() const {
+        return _exception;
+    }
+
+    // run t on the executor once ready (at once if already ready).
+    void onReady(Task&& t) {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (!ready()) {
+                _continuation = std::move(t);
+                return;
+            }
+        }
+        dispatch(std::move(t));
+    }
+
+    Executor* executor() const {
+        return _executor;
+    }
+private:
+    explicit SharedState(Executor* executor) : _executor(executor) {}
+
+    void complete(std::unique_lock<std::mutex>& lock) {
+        _ready.store(true, std::memory_order_release);
+        Task continuation(std::move(_continuation));
+        bool notify = _waiters > 0;
+        lock.unlock();
+        if (notify)
+            _cond.notify_all();
+        if (continuation)
+            dispatch(std::move(continuation));
+    }
+
+    void dispatch(Task&& t) {
+        if (_executor)
+            _executor->execute(std::move(t));
+        else
+            t();
+    }
+private:
+    std::atomic<int> _refs{1};
+    std::atomic_bool _ready{false};
+    std::mutex _mtx;
+    std::condition_variable _cond;
+    int _waiters = 0;
+    ValueSlot<T> _value;
+    std::exception_ptr _exception;
+    Task _continuation;
+    Executor* _executor;
+};
+
+// Intrusive pointer to a SharedState.
+template<typename T>
+class StateRef {
+public:
+    StateRef() : _state(nullptr) {}
+    explicit StateRef(SharedState<T>* state) : _state(state) {}
+    StateRef(const StateRef& that) : _state(that._state) {
+        if (_state)
+            _state->addRef();
+    }
+    StateRef(StateRef&& that) noexcept : _state(that._state) {
+        that._state = nullptr;
+    }
+    StateRef& operator=(StateRef that) noexcept {
+        std::swap(_state, that._state);
+        return *this;
+    }
+    ~StateRef() {
+        if (_state)
+            _state->release();
+    }
+    SharedState<T>* operator->() const { return _state; }
+    explicit operator bool() const { return _state != nullptr; }
+private:
+    SharedState<T>* _state;
+};
+
+}// namespace detail
+
+
+// Write end of a Future, moved into the task that produces the result.
+template<typename T>
+class Promise {
+public:
+    explicit Promise(Executor* executor = nullptr)
+        : _state(detail::SharedState<T>::create(executor)) {
+    }
+
+    // a promise dropped unfulfilled (e.g. its task was cleaned from the
+    // queue) fails the future instead of leaving it waiting forever.
+    ~Promise() {
+        if (_state && !_state->ready())
+            _state->setException(std::make_exception_ptr(std::runtime_error("broken promise")));
+    }
+
+    // noexcept, so tasks holding a promise stay in Task's inline buffer.
+    Promise(Promise&&) noexcept = default;
+    Promise& operator=(Promise&&) noexcept = default;
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    Future<T> getFuture() {
+        return Future<T>(_state);
+    }
+
+    template<typename... A>
+    void setValue(A&&... a) {
+        _state->setValue(std::forward<A>(a)...);
+    }
+
+    void setException(std::exception_ptr e) {
+        _state->setException(e);
+    }
+private:
+    detail::StateRef<T> _state;
+};
+
+
+namespace detail {
+
+// call f(args...) and store its result (or exception) into promise.
+template<typename R>
+struct Fulfill {
+    template<typename F, typename... A>
+    static void run(Promise<R>& promise, F& f, A&&... a) {
+        try {
+            promise.setValue(f(std::forward<A>(a)...));
+        }
+        catch (...) {
+            promise.setException(std::current_exception());
+        }
+    }
+};
+
+template<>
+struct Fulfill<void> {
+    template<typename F, typename... A>
+    static void run(Promise<void>& promise, F& f, A&&... a) {
+        try {
+            f(std::forward<A>(a)...);
+            promise.setValue();
+        }
+        catch (...) {
+            promise.setException(std::current_exception());
+        }
+    }
+};
+
+// result of a continuation given the future's value type.
+template<typename F, typename T>
+struct ThenResult {
+    typedef decltype(std::declval<F&>()(std::declval<T>())) type;
+};
+
+template<typename F>
+struct ThenResult<F, void> {
+    typedef decltype(std::declval<F&>()()) type;
+};
+
+}// namespace detail
+
+
+// Result of BasicThreadPool::async. get() rethrows the task's exception.
+// Waiting on a future whose task belongs to a pool runs other tasks of
+// that pool on the waiting thread instead of just blocking.
+template<typename T>
+class Future {
+public:
+    Future() {}
+
+    Future(Future&&) = default;
+    Future& operator=(Future&&) = default;
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    bool valid() const {
+        return (bool)_state;
+    }
+
+    bool ready() const {
+        return _state->ready();
+    }
+
+    void wait() const {
+        _state->wait();
+    }
+
+    // plain timed wait, does not help the pool.
+    template<typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period>& timeout) const {
+        return _state->waitFor(timeout);
+    }
+
+    // wait and take the value, the future is no longer valid afterwards.
+    T get() {
+        detail::StateRef<T> state(std::move(_state));
+        state->wait();
+        return state->take();
+    }
+
+    // run f(value) on the pool once this future is ready, the returned
+    // future holds f's result. An exception skips f and is passed on.
+    // This future is no longer valid afterwards.
+    template<typename F>
+    Future<typename detail::ThenResult<typename std::decay<F>::type, T>::type> then(F&& f) {
+        typedef typename std::decay<F>::type Fn;
+        typedef typename detail::ThenResult<Fn, T>::type R;
+        detail::StateRef<T> state(std::move(_state));
+        Promise<R> promise(state->executor());
+        Future<R> future = promise.getFuture();
+        detail::SharedState<T>* raw = state.operator->();
+        static_assert(std::is_nothrow_move_constructible<Continuation<Fn, R>>::value
+            || !std::is_nothrow_move_constructible<Fn>::value, "a continuation must move as cheaply as f");
+        raw->onReady(Continuation<Fn, R>(std::move(state), std::move(promise), std::forward<F>(f)));
+        return future;
+    }
+private:
+    friend class Promise<T>;
+
+    explicit Future(const detail::StateRef<T>& state) : _state(state) {}
+
+    template<typename Fn, typename R>
+    struct Continuation {
+        template<typename F>
+        Continuation(detail::StateRef<T>&& s, Promise<R>&& p, F&& fn)
+            : state(std::move(s)), promise(std::move(p)), f(std::forward<F>(fn)) {
+        }
+        void operator()() {
+            if (state->exception()) {
+                promise.setException(state->exception());
+                return;
+            }
+            call(std::is_void<T>());
+        }
+        void call(std::true_type) {
+            detail::Fulfill<R>::run(promise, f);
+        }
+        void call(std::false_type) {
+            detail::Fulfill<R>::run(promise, f, state->take());
+        }
+        detail::StateRef<T> state;
+        Promise<R> promise;
+        Fn f;
+    };
+private:
+    detail::StateRef<T> _state;
+};
+
+}// namespace
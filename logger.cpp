@@ -1,6 +1,13 @@
-﻿#include <stdexcept>
+﻿#include <cstring>
+#include <stdexcept>
 #include <algorithm>
 
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#endif // !_WIN32
+
 #include "logger.h"
 #include "file.h"
 
@@ -42,11 +49,24 @@ static const char *LOG_CONST_TABLE[][3] = {
 #endif
 
 
+Logger::Logger(const std::string &loggerName) :
+    _minLevel(kLevelOff),
+    _loggerName(loggerName) {
+#ifdef _WIN32
+    _prefix = _loggerName + "[" + std::to_string(GetCurrentProcessId()) + "] ";
+#else
+    _prefix = _loggerName + "[" + std::to_string(getpid()) + "] ";
+#endif // _WIN32
+}
+
 Logger::~Logger() {
     _writer.reset();
     {
         LogContextCapturer(*this, LInfo, __FILE__, __FUNCTION__, __LINE__);
     }
+    for (auto &channel : _channels) {
+        channel.second->_logger = nullptr;
+    }
     _channels.clear();
 }
 
@@ -54,14 +74,25 @@ Logger::~Logger() {
 // Add a LogChannel for Logger. 
 void 
 Logger::addChannel(const std::shared_ptr<LogChannel> &channel) {
-    _channels[channel->name()] = channel;
+    auto &slot = _channels[channel->name()];
+    if (slot) {
+        slot->_logger = nullptr;
+    }
+    slot = channel;
+    channel->_logger = this;
+    updateLevel();
 }
 
 
 // Del a LogChannel from Logger.
 void 
 Logger::delChannel(const std::string &name) {
-    _channels.erase(name);
+    auto it = _channels.find(name);
+    if (it == _channels.end())
+        return;
+    it->second->_logger = nullptr;
+    _channels.erase(it);
+    updateLevel();
 }
 
 // Get a LogChannel from Logger.
@@ -77,15 +108,25 @@ Logger::getChannel(const std::string &name) {
 void 
 Logger::setLevel(LogLevel level) {
     for (auto &channel : _channels) {
-        channel.second->setLevel(level);
+        channel.second->_level = level;
+    }
+    updateLevel();
+}
+
+void
+Logger::updateLevel() {
+    int level = kLevelOff;
+    for (auto &channel : _channels) {
+        level = std::min<int>(level, channel.second->_level);
     }
+    _minLevel.store(level, std::memory_order_relaxed);
 }
 
 // Write Log.
 void 
-Logger::write(const LogContextPtr &ctx) {
+Logger::write(LogContextPtr &&ctx) {
     if (_writer) {
-        _writer->write(ctx);
+        _writer->write(std::move(ctx));
     }
     else {
         writeChannels(ctx);
@@ -122,17 +163,179 @@ static inline const char *getFunctionName(const char *func) {
 #endif
 }
 
-LogContext::LogContext(
-    LogLevel level, 
-    const char *file, 
-    const char *function, 
-    int line) 
-    :
-    _level(level),
-    _line(line),
-    _file(getFileName(file)),
-    _function(getFunctionName(function)) {
+// LogBuffer
+void
+LogBuffer::clear() {
+    // one huge line should not stay pinned to the thread.
+    if (_data.capacity() > 4096) {
+        std::string().swap(_data);
+    }
+    _data.clear();
+}
+
+LogBuffer::int_type
+LogBuffer::overflow(int_type c) {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        _data.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize
+LogBuffer::xsputn(const char *s, std::streamsize n) {
+    _data.append(s, (size_t)n);
+    return n;
+}
+
+/*
+*Summary: free LogContexts of one thread.
+*        The owner takes and gives back its contexts without atomics.
+*        Other threads (an AsyncLogWriter) push them on a lock-free
+*        stack that the owner empties with one exchange when its own
+*        list runs dry. The pool keeps as many contexts as its thread
+*        ever had in flight at once, and lives until its thread has
+*        exited and the last of them is back.
+*/
+class LogContextPool {
+public:
+    LogContext *take() {
+        if (!_free) {
+            _free = _returned.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (LogContext *ctx = _free) {
+            _free = ctx->_nextFree;
+            return ctx;
+        }
+        _contexts.fetch_add(1, std::memory_order_relaxed);
+        return new LogContext(this);
+    }
+
+    // owner thread only.
+    void giveLocal(LogContext *ctx) {
+        ctx->_nextFree = _free;
+        _free = ctx;
+    }
+
+    void giveRemote(LogContext *ctx) {
+        LogContext *head = _returned.load(std::memory_order_relaxed);
+        do {
+            if (head == closed()) {
+                destroy(ctx);
+                return;
+            }
+            ctx->_nextFree = head;
+        } while (!_returned.compare_exchange_weak(head, ctx,
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // owner thread, on its exit: contexts still out are deleted on return.
+    void close() {
+        destroyList(_free);
+        _free = nullptr;
+        destroyList(_returned.exchange(closed(), std::memory_order_acquire));
+        release();
+    }
+
+    static LogContextPool *local();
+private:
+    static LogContext *closed() {
+        return reinterpret_cast<LogContext*>(&s_closed);
+    }
+
+    void destroy(LogContext *ctx) {
+        delete ctx;
+        release();
+    }
+
+    void destroyList(LogContext *ctx) {
+        while (ctx) {
+            LogContext *next = ctx->_nextFree;
+            destroy(ctx);
+            ctx = next;
+        }
+    }
+
+    void release() {
+        if (_contexts.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+private:
+    static char s_closed;
+
+    LogContext *_free = nullptr;
+    std::atomic<LogContext*> _returned{ nullptr };
+    // contexts allocated and not deleted, plus one for the owner thread.
+    std::atomic<size_t> _contexts{ 1 };
+};
+
+char LogContextPool::s_closed;
+
+static thread_local LogContextPool *t_contextPool = nullptr;
+static thread_local bool t_contextPoolClosed = false;
+
+namespace {
+struct LogContextPoolCloser {
+    ~LogContextPoolCloser() {
+        t_contextPool->close();
+        t_contextPool = nullptr;
+        t_contextPoolClosed = true;
+    }
+};
+}// namespace
+
+// this thread's pool, nullptr while its thread_locals are torn down.
+LogContextPool *
+LogContextPool::local() {
+    if (!t_contextPool && !t_contextPoolClosed) {
+        static thread_local LogContextPoolCloser closer;
+        t_contextPool = new LogContextPool();
+    }
+    return t_contextPool;
+}
+
+LogContext::LogContext(LogContextPool *pool) :
+    std::ostream(nullptr),
+    _pool(pool) {
+    rdbuf(&_buffer);
+}
+
+void
+LogContext::reset(LogLevel level, const char *file, const char *function, int line) {
+    _level = level;
+    _file = getFileName(file);
+    _function = getFunctionName(function);
+    _line = line;
     gettimeofday(&_tv, NULL);
+    _buffer.clear();
+    // drop whatever manipulators the last line left behind.
+    clear();
+    flags(std::ios_base::skipws | std::ios_base::dec);
+    precision(6);
+    width(0);
+    fill(' ');
+}
+
+LogContextPtr
+LogContext::create(LogLevel level, const char *file, const char *function, int line) {
+    LogContextPool *pool = LogContextPool::local();
+    LogContext *ctx = pool ? pool->take() : new LogContext(nullptr);
+    ctx->reset(level, file, function, line);
+    return LogContextPtr(ctx);
+}
+
+void
+LogContextRecycler::operator()(LogContext *ctx) const {
+    LogContextPool *pool = ctx->_pool;
+    if (!pool) {
+        delete ctx;
+    }
+    else if (pool == t_contextPool) {
+        pool->giveLocal(ctx);
+    }
+    else {
+        pool->giveRemote(ctx);
+    }
 }
 
 // LogContextCapturer
@@ -142,14 +345,13 @@ LogContextCapturer::LogContextCapturer(
     const char *file,
     const char *function,
     int line
-) : _ctx(new LogContext(level, file, function, line)), 
+) : _ctx(LogContext::create(level, file, function, line)), 
     _logger(logger) {
 }
 
 LogContextCapturer::LogContextCapturer(const LogContextCapturer &that) :
-    _ctx(that._ctx),
+    _ctx(std::move(const_cast<LogContextPtr&>(that._ctx))),
     _logger(that._logger) {
-    const_cast<LogContextPtr&>(that._ctx).reset();
 }
 
 LogContextCapturer::~LogContextCapturer() {
@@ -167,7 +369,8 @@ LogContextCapturer::operator<<(std::ostream &(*f)(std::ostream &)) {
     if (!_ctx) {
         return *this;
     }
-    _logger.write(_ctx);
+    _logger.write(std::move(_ctx));
+    // back to the pool, if the logger did not keep it.
     _ctx.reset();
     return *this;
 }
@@ -175,6 +378,7 @@ LogContextCapturer::operator<<(std::ostream &(*f)(std::ostream &)) {
 //AsyncLogWriter
 AsyncLogWriter::AsyncLogWriter(Logger &logger) :
     _exit(false),
+    _parked(false),
     _logger(logger) {
     _thread = std::make_shared<std::thread>([this]() {this->run(); });
 }
@@ -186,41 +390,51 @@ AsyncLogWriter::~AsyncLogWriter() {
     flushAll();
 }
 
+/*
+*Summary: drain the queue, park on _sem once it stays empty.
+*        A write only posts when it finds the writer parked, so a
+*        busy writer costs producers no syscall at all.
+*/
 void
 AsyncLogWriter::run() {
     while (!_exit) {
-        _sem.wait();
-        flushAll();
+        if (flushAll() != 0) {
+            continue;
+        }
+        // seq_cst, as the push in write(): either the writer sees the
+        // new entry here, or the write sees _parked.
+        _parked.store(true);
+        if (_pending.empty() && !_exit) {
+            _sem.wait();
+        }
+        else {
+            // an entry came in meanwhile, or is halfway through its push.
+            _parked.store(false);
+            std::this_thread::yield();
+        }
     }
 }
 
-void 
+// Write out everything queued so far in one pass, return the count.
+// Writer thread only.
+size_t
 AsyncLogWriter::flushAll() {
-    std::list<LogContextPtr> tmp;
-    {
-        std::lock_guard<std::mutex> lock(_mutex);
-        tmp.swap(_pending);
-    }
-    /*
-    tmp.for_each([&](const LogContextPtr &ctx) {
+    size_t n = 0;
+    while (LogContext *node = _pending.pop()) {
+        LogContextPtr ctx(node);
         _logger.writeChannels(ctx);
-    });
-    */
-    std::for_each(
-        tmp.begin(), 
-        tmp.end(), 
-        [&](const LogContextPtr &ctx) {
-            _logger.writeChannels(ctx); 
-        });
+        ++n;
+    }
+    return n;
 }
 
 void
-AsyncLogWriter::write(const LogContextPtr &ctx) {
-    {
-        std::lock_guard<std::mutex> lock(_mutex);
-        _pending.emplace_back(ctx);
+AsyncLogWriter::write(LogContextPtr &&ctx) {
+    // owned by the queue until flushAll() takes it back.
+    _pending.push(ctx.release());
+    if (_parked.load() && _parked.exchange(false)) {
+        _sem.post();
     }
-    _sem.post();
 }
 
 //LogChannel
@@ -233,22 +447,64 @@ LogChannel::LogChannel(const std::string &name, LogLevel level, bool enableDeati
 LogChannel::~LogChannel() {
 }
 
+void
+LogChannel::setLevel(LogLevel level) {
+    _level = level;
+    if (_logger) {
+        _logger->updateLevel();
+    }
+}
+
 std::string
 LogChannel::printTime(const timeval &tv) {
-    time_t second = tv.tv_sec;
-    struct tm *tm = localtime(&second);
-    char buff[128];
-    snprintf(buff, sizeof(buff), "%d-%02d-%02d %02d:%02d:%02d.%03d",
-            1900 + tm->tm_year,
-            1 + tm->tm_mon,
-            tm->tm_mday,
-            tm->tm_hour,
-            tm->tm_min,
-            tm->tm_sec,
-            (int) (tv.tv_usec / 1000)
-            );
-    return buff;
+    size_t len;
+    const char *text = formatTime(tv, len);
+    return std::string(text, len);
+}
 
+/*
+*Summary: "YYYY-MM-DD HH:MM:SS.mmm" of tv.
+*        The date and time are only rebuilt when the second changes,
+*        otherwise the cached text gets new milliseconds patched in.
+*        Cached per thread, so channels written from several threads
+*        in sync mode do not share it.
+*/
+const char *
+LogChannel::formatTime(const timeval &tv, size_t &len) {
+    struct TimeCache {
+        time_t second = -1;
+        size_t len = 0;
+        char text[64];
+    };
+    static thread_local TimeCache cache;
+
+    time_t second = tv.tv_sec;
+    if (second != cache.second) {
+        struct tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &second);
+#else
+        localtime_r(&second, &tm);
+#endif // _WIN32
+        int n = snprintf(cache.text, sizeof(cache.text), "%d-%02d-%02d %02d:%02d:%02d.000",
+                1900 + tm.tm_year,
+                1 + tm.tm_mon,
+                tm.tm_mday,
+                tm.tm_hour,
+                tm.tm_min,
+                tm.tm_sec);
+        cache.len = n > 0 ? std::min((size_t)n, sizeof(cache.text) - 1) : 0;
+        cache.second = second;
+    }
+    if (cache.len >= 3) {
+        int ms = (int)(tv.tv_usec / 1000);
+        char *p = cache.text + cache.len - 3;
+        p[0] = (char)('0' + ms / 100);
+        p[1] = (char)('0' + ms / 10 % 10);
+        p[2] = (char)('0' + ms % 10);
+    }
+    len = cache.len;
+    return cache.text;
 }
 
 void
@@ -267,23 +523,21 @@ LogChannel::format(
 #ifdef _WIN32
         SetConsoleColor(LOG_CONST_TABLE[ctx->_level][1]);
 #else
-        ost << LOG_CONST_TABLE[ctx->level][1];
+        ost << LOG_CONST_TABLE[ctx->_level][1];
 #endif // _WIN32
     }
 
+    size_t timeLen;
+    const char *time = formatTime(ctx->_tv, timeLen);
+    ost.write(time, timeLen);
 #ifdef _WIN32
-    ost << printTime(ctx->_tv) << " " << (char)LOG_CONST_TABLE[ctx->_level][2] << " ";
+    ost << " " << (char)LOG_CONST_TABLE[ctx->_level][2] << " ";
 #else
-    ost << printTime(ctx->_tv) << " " << LOG_CONST_TABLE[ctx->_level][2] << " ";
+    ost << " " << LOG_CONST_TABLE[ctx->_level][2] << " ";
 #endif // _WIN32
 
     if (enableDetail) {
-#ifdef _WIN32
-        ost << logger.getName() << "[" << GetCurrentProcessId();
-#else
-        ost << logger.getName() << "[" << getpid();
-#endif // _WIN32
-        ost << "] " << ctx->_file << ":" << ctx->_line << " " << ctx->_function << " | ";
+        ost << logger.getPrefix() << ctx->_file << ":" << ctx->_line << " " << ctx->_function << " | ";
     }
 
     ost << ctx->str();
@@ -4,12 +4,13 @@
 #include <stdio.h>
 #include <string>
 #include <map>
-#include <list>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <atomic>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -18,6 +19,7 @@
 
 #include "util.h"
 #include "semaphore.h"
+#include "mpscQueue.h"
 
 typedef enum {
     LTrace = 0,
@@ -27,11 +29,23 @@ typedef enum {
     LError
 } LogLevel;
 
+// Calls below this level are compiled out of TraceL and friends, e.g.
+// -DLOG_MIN_LEVEL=LInfo for release builds.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LTrace
+#endif // LOG_MIN_LEVEL
+
 class LogWriter;
 class LogChannel;
 class LogContext;
+class LogContextPool;
+
+// hands a LogContext back to the pool of the thread that took it.
+struct LogContextRecycler {
+    void operator()(LogContext *ctx) const;
+};
 
-typedef std::shared_ptr<LogContext> LogContextPtr;
+typedef std::unique_ptr<LogContext, LogContextRecycler> LogContextPtr;
 
 // Logger
 class Logger : public std::enable_shared_from_this<Logger>, public noncopyable {
@@ -42,7 +56,7 @@ public:
 
     static Logger &Instance();
 
-    Logger(const std::string &loggerName) : _loggerName(loggerName) {};
+    Logger(const std::string &loggerName);
     ~Logger();
 
     void addChannel(const std::shared_ptr<LogChannel> &channel);
@@ -53,36 +67,60 @@ public:
         return _loggerName;
     };
 
+    // "name[pid] ", rendered once for the detail of every line.
+    const std::string &getPrefix() const {
+        return _prefix;
+    };
+
     void setLevel(LogLevel level);
 
+    // whether some channel takes level, one relaxed load.
+    bool enabled(LogLevel level) const {
+        return level >= _minLevel.load(std::memory_order_relaxed);
+    }
+
+    // recompute the lowest level of all channels.
+    void updateLevel();
+
     void setWriter(const std::shared_ptr<LogWriter> &writer) {
         _writer = writer;
     };
 
-    void write(const LogContextPtr &ctx);
+    void write(LogContextPtr &&ctx);
 private:
     void writeChannels(const LogContextPtr &ctx);
 private:
+    // above every level: no channel, nothing is written.
+    static const int kLevelOff = LError + 1;
+
     std::map<std::string, std::shared_ptr<LogChannel>> _channels;
     std::shared_ptr<LogWriter> _writer;
+    // lowest level of all channels, read by every log call.
+    std::atomic<int> _minLevel;
     std::string _loggerName;
+    std::string _prefix;
 
 };
 
 class LogChannel : public noncopyable {
 public:
+    friend class Logger;
+
     LogChannel(const std::string &name, LogLevel level = LTrace, bool enableDetail = true);
     virtual ~LogChannel();
     virtual void write(const Logger &logger, const LogContextPtr &ctx) = 0;
     
     const std::string &name() const { return _name; };
-    void setLevel(LogLevel level) { _level = level; };
+    void setLevel(LogLevel level);
 
     // modifiable
     void setDetail(bool enableDetail) { _enableDetail = enableDetail; };
 
     static std::string printTime(const timeval &tv);
 protected:
+    // printTime() into a per-thread buffer, valid until the next call.
+    static const char *formatTime(const timeval &tv, size_t &len);
+
     virtual void format(
         const Logger &logger,
         std::ostream &ost,
@@ -97,6 +135,8 @@ protected:
     // As a FLAG whether to write Log's detail, 
     // for some situation that don't want detail. 
     bool _enableDetail;
+    // the Logger this channel was added to, told about level changes.
+    Logger *_logger = nullptr;
 };
 
 class ConsoleChannel : public LogChannel {
@@ -153,18 +193,48 @@ private:
     int _logMaxDay = 30;
 };
 
+// Appends to a string that keeps its capacity across clear().
+class LogBuffer : public std::streambuf {
+public:
+    const std::string &str() const { return _data; }
+    void clear();
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+private:
+    std::string _data;
+};
+
 // Log info.
-class LogContext : public std::ostringstream {
+// Taken from a per-thread pool by create() and given back when the last
+// LogContextPtr lets go, so a warm thread logs without heap allocations.
+// file and function point at the __FILE__ and __FUNCTION__ literals.
+// Linked into AsyncLogWriter's queue through its MpscNode.
+class LogContext : public std::ostream, public multi_thread::MpscNode {
 public:
-    LogContext(LogLevel level, const char *file, const char *function, int line);
-    ~LogContext() = default;
+    static LogContextPtr create(LogLevel level, const char *file, const char *function, int line);
+
+    const std::string &str() const { return _buffer.str(); }
 
     LogLevel _level;
-    std::string _file;
-    std::string _function;
+    const char *_file;
+    const char *_function;
     int _line;
     struct timeval _tv;
-    
+private:
+    friend class LogContextPool;
+    friend struct LogContextRecycler;
+
+    explicit LogContext(LogContextPool *pool);
+    ~LogContext() = default;
+
+    void reset(LogLevel level, const char *file, const char *function, int line);
+private:
+    LogBuffer _buffer;
+    // pool it goes back to, which outlives its thread until every context
+    // is back; nullptr if made while its thread's pool was torn down.
+    LogContextPool *_pool;
+    LogContext *_nextFree = nullptr;
 };
 
 class LogContextCapturer {
@@ -202,22 +272,25 @@ class LogWriter : public noncopyable {
 public:
     LogWriter() {}
     virtual ~LogWriter() {}
-    virtual void write(const LogContextPtr &ctx) = 0;
+    virtual void write(LogContextPtr &&ctx) = 0;
 };
 
+// Writes on a background thread. Producers push onto a lock-free MPSC
+// queue and only post the semaphore when the writer is parked on it.
 class AsyncLogWriter : public LogWriter {
 public:
     AsyncLogWriter(Logger &logger = Logger::Instance());
     ~AsyncLogWriter();
 private:
     void run();
-    void flushAll();
-    void write(const LogContextPtr &ctx) override;
+    size_t flushAll();
+    void write(LogContextPtr &&ctx) override;
 private:
-    bool _exit;
+    std::atomic<bool> _exit;
+    // the writer is waiting on _sem, or about to.
+    std::atomic<bool> _parked;
     std::shared_ptr<std::thread> _thread;
-    std::list<LogContextPtr> _pending;
-    std::mutex _mutex;
+    multi_thread::MpscQueue<LogContext> _pending;
     Semaphore _sem;
     Logger &_logger;
 };
@@ -225,11 +298,23 @@ private:
 
 extern Logger* g_defaultLogger;
 
-#define TraceL LogContextCapturer(*g_defaultLogger, LTrace, __FILE__,__FUNCTION__, __LINE__)
-#define DebugL LogContextCapturer(*g_defaultLogger,LDebug, __FILE__,__FUNCTION__, __LINE__)
-#define InfoL LogContextCapturer(*g_defaultLogger,LInfo, __FILE__,__FUNCTION__, __LINE__)
-#define WarnL LogContextCapturer(*g_defaultLogger,LWarn,__FILE__, __FUNCTION__, __LINE__)
-#define ErrorL LogContextCapturer(*g_defaultLogger,LError,__FILE__, __FUNCTION__, __LINE__)
-#define WriteL(level) LogContextCapturer(*g_defaultLogger,level,__FILE__, __FUNCTION__, __LINE__)
+// Makes `cond ? (void)0 : LogVoidify() & capturer << ...` one void
+// expression; & binds looser than <<.
+class LogVoidify {
+public:
+    void operator&(const LogContextCapturer &) {}
+};
 
+// The level is checked before the capturer is built or any argument is
+// evaluated: a disabled call is one compare, or nothing at all when it
+// is below LOG_MIN_LEVEL.
+#define WriteL(level) \
+    ((level) < LOG_MIN_LEVEL || !g_defaultLogger->enabled(level)) ? (void)0 : \
+    LogVoidify() & LogContextCapturer(*g_defaultLogger, level, __FILE__, __FUNCTION__, __LINE__)
+
+#define TraceL WriteL(LTrace)
+#define DebugL WriteL(LDebug)
+#define InfoL WriteL(LInfo)
+#define WarnL WriteL(LWarn)
+#define ErrorL WriteL(LError)
 
@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+
+#include "ringQueue.h"
+
+namespace multi_thread {
+
+// Link field for MpscQueue, derive the queued type from it.
+struct MpscNode {
+    std::atomic<MpscNode*> next{nullptr};
+};
+
+// Intrusive unbounded multi-producer/single-consumer queue (Vyukov).
+// push() is one atomic exchange plus a store and never waits. The
+// exchange and the load in empty() are seq_cst, so a consumer that
+// announces it is going to sleep and then finds the queue empty() can
+// rely on the producer seeing that announcement (an eventcount, see
+// AsyncLogWriter). pop() is
+// for one consumer at a time. A push that has swapped the head but not
+// linked its node yet hides it (and everything after it) from pop() for
+// that instant, so pop() returning nullptr means "nothing ready", not
+// necessarily "empty".
+template<typename T>
+class MpscQueue {
+public:
+    MpscQueue() : _head(&_stub), _tail(&_stub) {}
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // any thread.
+    void push(T* node) {
+        pushNode(node);
+    }
+
+    // consumer only.
+    T* pop() {
+        MpscNode* tail = _tail;
+        MpscNode* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &_stub) {
+            if (!next)
+                return nullptr;
+            _tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            _tail = next;
+            return static_cast<T*>(tail);
+        }
+        if (tail != _head.load(std::memory_order_acquire))
+            return nullptr;
+        // tail is the last node: put the stub behind it so it can go.
+        pushNode(&_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            _tail = next;
+            return static_cast<T*>(tail);
+        }
+        return nullptr;
+    }
+
+    // consumer only. seq_cst: ordered after the sleep announcement.
+    bool empty() const {
+        return _tail == _head.load(std::memory_order_seq_cst) && _tail == &_stub;
+    }
+private:
+    void pushNode(MpscNode* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        MpscNode* prev = _head.exchange(node, std::memory_order_seq_cst);
+        prev->next.store(node, std::memory_order_release);
+    }
+private:
+    char _pad0[kCacheLineSize];
+    std::atomic<MpscNode*> _head;
+    char _pad1[kCacheLineSize - sizeof(std::atomic<MpscNode*>)];
+    MpscNode* _tail;
+    MpscNode _stub;
+    char _pad2[kCacheLineSize];
+};
+
+}// namespace
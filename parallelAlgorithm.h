@@ -0,0 +1,222 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+
+#include "threadPool.h"
+
+namespace multi_thread {
+
+// Parallel versions of common algorithms on random access ranges, run on
+// a pool through parallel_for (the calling thread takes part):
+//
+//   double sum = parallel_reduce(pool, v.begin(), v.end(), 0.0, std::plus<double>());
+//   parallel_sort(pool, v.begin(), v.end());
+//
+// The range is cut into chunks of whole cache lines (at least
+// kMinChunkBytes each, a few per worker), so two chunks never write to
+// the same line of an aligned output and a chunk is worth a task.
+// Partial results are kept per chunk, each on its own cache line, and
+// combined in range order: op must be associative, not commutative.
+// The first exception thrown by an element function is rethrown.
+
+static const size_t kMinChunkBytes = 16 * 1024;
+static const size_t kChunksPerThread = 4;
+
+namespace detail {
+
+// a partial result that shares its cache line with nobody else's.
+template<typename T>
+struct PaddedSlot {
+    explicit PaddedSlot(const T& v) : value(v) {}
+    T value;
+    char _pad[kCacheLineSize];
+};
+
+// elements per chunk for n elements of T on threads workers.
+template<typename T>
+size_t chunkSize(size_t n, int threads) {
+    size_t perLine = std::max<size_t>(1, kCacheLineSize / sizeof(T));
+    size_t parts = (size_t)(std::max(threads, 1) + 1) * kChunksPerThread;
+    size_t chunk = std::max(n / parts, kMinChunkBytes / sizeof(T));
+    chunk = std::max<size_t>(chunk, 1);
+    return (chunk + perLine - 1) / perLine * perLine;
+}
+
+// how many of the first k elements of merge(a, b) come from a; ties
+// go to a, as with std::merge.
+template<typename It, typename Comp>
+size_t coRank(size_t k, It a, size_t la, It b, size_t lb, Comp& comp) {
+    size_t lo = k > lb ? k - lb : 0;
+    size_t hi = std::min(k, la);
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        if (comp(b[k - i - 1], a[i]))
+            hi = i;
+        else
+            lo = i + 1;
+    }
+    return lo;
+}
+
+// one round of merge sort: merge runs 2p and 2p + 1 of src into dst,
+// every merge split into chunk-sized pieces of output by co-rank. An odd
+// last run is moved over as it is. The splits are found before anything
+// is moved, pieces run in parallel and move from src.
+template<typename Pool, typename Src, typename Dst, typename Comp>
+void mergeRound(Pool& pool, Src src, Dst dst, const std::vector<size_t>& bounds,
+                size_t chunk, Comp& comp) {
+    struct Piece {
+        size_t a0, a1;      // taken from [lo, mid)
+        size_t b0, b1;      // taken from [mid, hi)
+        size_t out;
+    };
+    std::vector<Piece> pieces;
+    for (size_t r = 0; r + 1 < bounds.size(); r += 2) {
+        size_t lo = bounds[r];
+        size_t mid = bounds[r + 1];
+        size_t hi = r + 2 < bounds.size() ? bounds[r + 2] : mid;
+        size_t i0 = 0;
+        for (size_t k = 0; k < hi - lo; k += chunk) {
+            size_t end = std::min(k + chunk, hi - lo);
+            size_t i1 = coRank(end, src + lo, mid - lo, src + mid, hi - mid, comp);
+            pieces.push_back(Piece{ lo + i0, lo + i1, mid + k - i0, mid + end - i1, lo + k });
+            i0 = i1;
+        }
+    }
+    pool.parallel_for((size_t)0, pieces.size(), [&](size_t p) {
+        const Piece& piece = pieces[p];
+        std::merge(std::make_move_iterator(src + piece.a0), std::make_move_iterator(src + piece.a1),
+                   std::make_move_iterator(src + piece.b0), std::make_move_iterator(src + piece.b1),
+                   dst + piece.out, comp);
+    });
+}
+
+}// namespace detail
+
+
+// op(init, op(x0, op(x1, ...))) grouped in chunks, for associative op.
+template<template<typename> class Queue, typename It, typename T, typename Op>
+T parallel_reduce(BasicThreadPool<Queue>& pool, It first, It last, T init, Op op) {
+    size_t n = std::distance(first, last);
+    if (n == 0)
+        return init;
+    size_t chunk = detail::chunkSize<typename std::iterator_traits<It>::value_type>(n, pool.threadCount());
+    size_t chunks = (n + chunk - 1) / chunk;
+    std::vector<detail::PaddedSlot<T>> partial(chunks, detail::PaddedSlot<T>(init));
+    pool.parallel_for((size_t)0, chunks, [&](size_t c) {
+        It it = first + c * chunk;
+        It end = first + std::min(n, (c + 1) * chunk);
+        T acc = *it;
+        for (++it; it != end; ++it) {
+            acc = op(std::move(acc), *it);
+        }
+        partial[c].value = std::move(acc);
+    });
+    for (auto& slot : partial) {
+        init = op(std::move(init), std::move(slot.value));
+    }
+    return init;
+}
+
+// out[i] = fn(first[i]); out may be first. Returns the end of out.
+template<template<typename> class Queue, typename It, typename Out, typename F>
+Out parallel_transform(BasicThreadPool<Queue>& pool, It first, It last, Out out, F fn) {
+    size_t n = std::distance(first, last);
+    size_t chunk = detail::chunkSize<typename std::iterator_traits<Out>::value_type>(n, pool.threadCount());
+    pool.parallel_for((size_t)0, (n + chunk - 1) / chunk, [&](size_t c) {
+        size_t begin = c * chunk;
+        size_t end = std::min(n, begin + chunk);
+        std::transform(first + begin, first + end, out + begin, fn);
+    });
+    return out + n;
+}
+
+// out[i] = op(first[0], ..., first[i]) for associative op; out may be
+// first. Three passes: reduce every chunk, scan the chunk totals, then
+// scan every chunk from its offset. Returns the end of out.
+template<template<typename> class Queue, typename It, typename Out, typename Op>
+Out parallel_inclusive_scan(BasicThreadPool<Queue>& pool, It first, It last, Out out, Op op) {
+    typedef typename std::iterator_traits<It>::value_type T;
+    size_t n = std::distance(first, last);
+    if (n == 0)
+        return out;
+    size_t chunk = detail::chunkSize<T>(n, pool.threadCount());
+    size_t chunks = (n + chunk - 1) / chunk;
+    std::vector<detail::PaddedSlot<T>> total(chunks, detail::PaddedSlot<T>(*first));
+    // the last chunk's total is never needed.
+    pool.parallel_for((size_t)0, chunks - 1, [&](size_t c) {
+        It it = first + c * chunk;
+        It end = it + chunk;
+        T acc = *it;
+        for (++it; it != end; ++it) {
+            acc = op(std::move(acc), *it);
+        }
+        total[c].value = std::move(acc);
+    });
+    for (size_t c = 1; c < chunks - 1; ++c) {
+        total[c].value = op(total[c - 1].value, std::move(total[c].value));
+    }
+    pool.parallel_for((size_t)0, chunks, [&](size_t c) {
+        size_t begin = c * chunk;
+        size_t end = std::min(n, begin + chunk);
+        It it = first + begin;
+        Out dst = out + begin;
+        T acc = c == 0 ? T(*it) : op(total[c - 1].value, *it);
+        *dst = acc;
+        for (++it, ++dst; it != first + end; ++it, ++dst) {
+            acc = op(std::move(acc), *it);
+            *dst = acc;
+        }
+    });
+    return out + n;
+}
+
+// sort [first, last) with comp, not stable. Chunks are sorted in
+// parallel, then merged pairwise in rounds through a buffer of the same
+// size, each merge split by co-rank so that every round keeps all
+// workers busy. Values must be default constructible and movable.
+template<template<typename> class Queue, typename It, typename Comp>
+void parallel_sort(BasicThreadPool<Queue>& pool, It first, It last, Comp comp) {
+    typedef typename std::iterator_traits<It>::value_type T;
+    size_t n = std::distance(first, last);
+    size_t chunk = detail::chunkSize<T>(n, pool.threadCount());
+    if (n <= chunk) {
+        std::sort(first, last, comp);
+        return;
+    }
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i < n; i += chunk) {
+        bounds.push_back(i);
+    }
+    bounds.push_back(n);
+    pool.parallel_for((size_t)0, bounds.size() - 1, [&](size_t c) {
+        std::sort(first + bounds[c], first + bounds[c + 1], comp);
+    });
+    std::vector<T> buffer(n);
+    bool inBuffer = false;
+    while (bounds.size() > 2) {
+        if (inBuffer)
+            detail::mergeRound(pool, buffer.begin(), first, bounds, chunk, comp);
+        else
+            detail::mergeRound(pool, first, buffer.begin(), bounds, chunk, comp);
+        inBuffer = !inBuffer;
+        std::vector<size_t> merged;
+        for (size_t r = 0; r < bounds.size() - 1; r += 2) {
+            merged.push_back(bounds[r]);
+        }
+        merged.push_back(n);
+        bounds.swap(merged);
+    }
+    if (inBuffer)
+        parallel_transform(pool, buffer.begin(), buffer.end(), first, [](T& v) { return std::move(v); });
+}
+
+template<template<typename> class Queue, typename It>
+void parallel_sort(BasicThreadPool<Queue>& pool, It first, It last) {
+    parallel_sort(pool, first, last, std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+}// namespace
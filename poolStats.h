@@ -0,0 +1,163 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+#include "ringQueue.h"
+
+namespace multi_thread {
+
+// Log2-bucketed latency histogram in nanoseconds: bucket 0 counts 0,
+// bucket i counts values in [2^(i-1), 2^i). The last bucket takes
+// everything above (about 39 hours).
+struct Histogram {
+    static const int kBuckets = 48;
+
+    uint64_t buckets[kBuckets] = {};
+
+    static int bucketOf(uint64_t ns) {
+        if (ns == 0)
+            return 0;
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, ns);
+        int bucket = (int)index + 1;
+#else
+        int bucket = 64 - __builtin_clzll(ns);
+#endif // _MSC_VER
+        return bucket < kBuckets ? bucket : kBuckets - 1;
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (uint64_t b : buckets) {
+            n += b;
+        }
+        return n;
+    }
+
+    // upper bound in ns of the bucket holding quantile q (0.5, 0.99, ...),
+    // 0 if empty. Good to a factor of two, which is what sizing needs.
+    uint64_t percentile(double q) const {
+        uint64_t total = count();
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * total);
+        if (rank >= total)
+            rank = total - 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i) {
+            seen += buckets[i];
+            if (seen > rank)
+                return i == 0 ? 0 : (1ull << i) - 1;
+        }
+        return (1ull << (kBuckets - 1)) - 1;
+    }
+
+    Histogram& operator+=(const Histogram& that) {
+        for (int i = 0; i < kBuckets; ++i) {
+            buckets[i] += that.buckets[i];
+        }
+        return *this;
+    }
+};
+
+// Counters of one worker. busyNs and idleNs are only kept with
+// PoolOptions::stats.
+struct WorkerStats {
+    uint64_t executed = 0;
+    uint64_t steals = 0;
+    // times the worker came back from parking.
+    uint64_t wakeups = 0;
+    uint64_t busyNs = 0;
+    uint64_t idleNs = 0;
+
+    WorkerStats& operator+=(const WorkerStats& that) {
+        executed += that.executed;
+        steals += that.steals;
+        wakeups += that.wakeups;
+        busyNs += that.busyNs;
+        idleNs += that.idleNs;
+        return *this;
+    }
+};
+
+// Result of BasicThreadPool::snapshot().
+struct PoolStats {
+    // one entry per worker slot, then one for tasks run by threads
+    // outside the pool (waits that help, caller-runs).
+    std::vector<WorkerStats> workers;
+    WorkerStats total;
+    // enqueue to start, and run time of tasks; PoolOptions::stats only.
+    Histogram queueWait;
+    Histogram execTime;
+    // submits that found the shared queue full, by outcome (see
+    // PoolOptions::overflow); blocked counts submits that had to wait.
+    uint64_t blocked = 0;
+    uint64_t timedOut = 0;
+    uint64_t rejected = 0;
+    uint64_t callerRuns = 0;
+    uint64_t dropped = 0;
+};
+
+namespace detail {
+
+// Live counters of one worker slot. Each slot has a single writer, so
+// updates are a relaxed load and store with no read-modify-write; the
+// slot shared by outside threads uses fetch_add instead. Readers may
+// see a slightly stale value, never a torn one. Padded on both sides so
+// neighbouring slots never share a cache line.
+class WorkerCounters {
+public:
+    enum Counter { kExecuted, kSteals, kWakeups, kBusyNs, kIdleNs, kCounters };
+
+    void setShared(bool shared) {
+        _shared = shared;
+    }
+
+    void add(Counter c, uint64_t v = 1) {
+        bump(_counters[c], v);
+    }
+
+    void recordWait(uint64_t ns) {
+        bump(_queueWait[Histogram::bucketOf(ns)], 1);
+    }
+
+    void recordExec(uint64_t ns) {
+        bump(_execTime[Histogram::bucketOf(ns)], 1);
+        bump(_counters[kBusyNs], ns);
+    }
+
+    void collect(WorkerStats& stats, Histogram& wait, Histogram& exec) const {
+        stats.executed = _counters[kExecuted].load(std::memory_order_relaxed);
+        stats.steals = _counters[kSteals].load(std::memory_order_relaxed);
+        stats.wakeups = _counters[kWakeups].load(std::memory_order_relaxed);
+        stats.busyNs = _counters[kBusyNs].load(std::memory_order_relaxed);
+        stats.idleNs = _counters[kIdleNs].load(std::memory_order_relaxed);
+        for (int i = 0; i < Histogram::kBuckets; ++i) {
+            wait.buckets[i] += _queueWait[i].load(std::memory_order_relaxed);
+            exec.buckets[i] += _execTime[i].load(std::memory_order_relaxed);
+        }
+    }
+private:
+    void bump(std::atomic<uint64_t>& c, uint64_t v) {
+        if (_shared)
+            c.fetch_add(v, std::memory_order_relaxed);
+        else
+            c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+private:
+    char _pad0[kCacheLineSize];
+    bool _shared = false;
+    std::atomic<uint64_t> _counters[kCounters] = {};
+    std::atomic<uint64_t> _queueWait[Histogram::kBuckets] = {};
+    std::atomic<uint64_t> _execTime[Histogram::kBuckets] = {};
+    char _pad1[kCacheLineSize];
+};
+
+}// namespace detail
+
+}// namespace
@@ -0,0 +1,284 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace multi_thread {
+
+static const size_t kCacheLineSize = 64;
+
+// Bounded lock-free multi-producer/multi-consumer queue.
+// Every slot carries a sequence number telling whether it is ready to be
+// written (seq == pos) or read (seq == pos + 1), so producers and consumers
+// only touch the shared head/tail with a single CAS each. Head and tail
+// live on separate cache lines.
+// Blocking consumers spin for a while and then park on a condition
+// variable; producers only take the lock when somebody is parked.
+// Interface matches ThreadSafeQueue so it can be given to BasicThreadPool.
+template<typename Task>
+class RingQueue {
+public:
+    // capacity is rounded up to a power of two.
+    explicit RingQueue(size_t capacity = 1024) : _done(false) {
+        init(capacity);
+    }
+
+    RingQueue(const RingQueue&) = delete;
+    RingQueue& operator=(const RingQueue&) = delete;
+
+    // push a Task to queue's back, return false when queue is full
+    // (t is left untouched then).
+    bool push_back(Task&& t) {
+        if (!tryPush(std::move(t)))
+            return false;
+        notify();
+        return true;
+    }
+
+    // a ring has a single level, priority tasks are queued like any other.
+    bool push(Task&& t, int /*level*/) {
+        return push_back(std::move(t));
+    }
+
+    bool push_front(Task&& t) {
+        return push_back(std::move(t));
+    }
+
+    // push as many of [first, last) as fit, then wake at most one parked
+    // consumer per task. Return the number of tasks queued.
+    template<typename It>
+    size_t push_batch(It first, It last) {
+        size_t n = 0;
+        for (; first != last; ++first, ++n) {
+            if (!tryPush(std::move(*first)))
+                break;
+        }
+        notify(n);
+        return n;
+    }
+
+    // get a task from queue, wait until queue has task or done.
+    void getTask(Task& t) {
+        getTask(t, epoch());
+    }
+
+    // as ThreadSafeQueue::getTask(t, seen, deadline).
+    void getTask(Task& t, unsigned seen,
+                 std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) {
+        for (int i = 0; i < kSpinCount; ++i) {
+            if (tryPop(t) || _done || _epoch.load() != seen)
+                return;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(_mtx);
+        _sleepers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto ready = [&] {
+            return _done || _epoch.load() != seen || tryPop(t);
+        };
+        if (deadline == std::chrono::steady_clock::time_point::max())
+            _ready.wait(lock, ready);
+        else
+            _ready.wait_until(lock, deadline, ready);
+        _sleepers.fetch_sub(1);
+    }
+
+    // t is only moved from when there is room.
+    template<typename T>
+    bool tryPush(T&& t) {
+        Cell* cell;
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[pos & _mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                // full.
+                return false;
+            }
+            else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->task = Task(std::forward<T>(t));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(Task& t) {
+        Cell* cell;
+        size_t pos = _head.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[pos & _mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                // empty.
+                return false;
+            }
+            else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+        t = std::move(cell->task);
+        cell->task = Task();
+        cell->seq.store(pos + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    unsigned epoch() const {
+        return _epoch.load();
+    }
+
+    void wakeOne() {
+        wake(1);
+    }
+
+    // as ThreadSafeQueue::wake(), the lock is only taken for sleepers.
+    void wake(size_t n) {
+        // seq_cst against the sleeper's count and fence in getTask().
+        _epoch.fetch_add(1);
+        if (_sleepers.load() == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+        }
+        if (n == 1)
+            _ready.notify_one();
+        else if (n > 1)
+            _ready.notify_all();
+    }
+
+    // no priority levels, nothing to age.
+    void setAging(std::chrono::microseconds) {
+    }
+
+    // getTask() always spins a little with yield, nothing to cap.
+    void setSpinners(int) {
+    }
+
+    // resize to capacity (rounded up to a power of two), 0 keeps the
+    // current one. Only before the queue is used.
+    void setCapacity(size_t capacity) {
+        if (capacity)
+            init(capacity);
+    }
+
+    // make room by taking the oldest task out.
+    bool dropOldest(Task& t) {
+        return tryPop(t);
+    }
+
+    // wait until the ring looks non-full, done or deadline; false unless
+    // there may be room. Consumers do not signal, so this backs off from
+    // yielding to short sleeps.
+    bool waitNotFull(std::chrono::steady_clock::time_point deadline) {
+        for (int i = 0; (size_t)size() >= capacity(); ++i) {
+            if (_done || std::chrono::steady_clock::now() >= deadline)
+                return false;
+            if (i < kSpinCount)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        return !_done;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // approximate while producers or consumers are running.
+    int size() const {
+        size_t tail = _tail.load(std::memory_order_acquire);
+        size_t head = _head.load(std::memory_order_acquire);
+        return tail > head ? (int)(tail - head) : 0;
+    }
+
+    size_t capacity() const {
+        return _mask + 1;
+    }
+
+    void clean() {
+        Task t;
+        while (tryPop(t))
+            ;
+    }
+
+    void done() {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _done = true;
+        }
+        _ready.notify_all();
+    }
+private:
+    // wake up to n parked consumers, only pays for the lock when one is
+    // parked.
+    void notify(size_t n = 1) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int sleepers = _sleepers.load(std::memory_order_relaxed);
+        if (sleepers == 0 || n == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+        }
+        if (n >= (size_t)sleepers) {
+            _ready.notify_all();
+            return;
+        }
+        while (n--) {
+            _ready.notify_one();
+        }
+    }
+private:
+    static const int kSpinCount = 64;
+
+    void init(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+        _mask = n - 1;
+        _cells.reset(new Cell[n]);
+        for (size_t i = 0; i < n; ++i) {
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+    }
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        Task task;
+    };
+
+    char _pad0[kCacheLineSize];
+    std::atomic<size_t> _head;
+    char _pad1[kCacheLineSize - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> _tail;
+    char _pad2[kCacheLineSize - sizeof(std::atomic<size_t>)];
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+
+    std::mutex _mtx;
+    std::condition_variable _ready;
+    std::atomic<int> _sleepers{0};
+    std::atomic<unsigned> _epoch{0};
+    std::atomic_bool _done;
+};
+
+}// namespace
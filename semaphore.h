@@ -1,64 +1,133 @@
 #pragma once
 
-#ifdef __linux__
-#include <semaphore.h>
-#define HAVE_SEM
-#endif // __linux__
-
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 
+#ifdef __linux__
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#define HAVE_FUTEX
+#else
 #include <mutex>
 #include <condition_variable>
+#endif // __linux__
+
 
-// On Linux, using sem_t from <semaphore>.
-// Otherwise, using mutex and condition_variable to implement semaphore.
+// Counting semaphore in user space: an atomic count plus the number of
+// threads waiting for it. post() and a wait() that finds the count above
+// zero are a few atomic operations; only a wait on zero blocks and only a
+// post that sees waiters wakes someone.
+// On Linux blocking is a futex wait on the count itself, otherwise a
+// mutex and condition_variable that are only touched by those two paths.
 class Semaphore {
 public:
-    explicit Semaphore(unsigned int init = 0) {
-#ifdef HAVE_SEM
-        sem_init(&_sem, 0, init);
-#else
-        _count = init;
-#endif // HAVE_SEM
+    explicit Semaphore(unsigned int init = 0) : _count((int)init), _waiters(0) {}
+
+    Semaphore(const Semaphore&) = delete;
+    Semaphore& operator=(const Semaphore&) = delete;
+
+    // add n and wake min(n, waiters) threads, with one call.
+    void post(unsigned int n = 1) {
+        if (n == 0)
+            return;
+        // seq_cst on both sides: either we see the waiter, or the waiter
+        // sees the new count before it sleeps.
+        _count.fetch_add((int)n, std::memory_order_seq_cst);
+        int waiters = _waiters.load(std::memory_order_seq_cst);
+        if (waiters > 0)
+            wake(std::min((int)n, waiters));
     }
 
-    ~Semaphore() {
-#ifdef HAVE_SEM
-        sem_destory(&_sem);
-#endif // HAVE_SEM
+    void wait() {
+        if (try_wait())
+            return;
+        _waiters.fetch_add(1, std::memory_order_seq_cst);
+        while (!try_wait()) {
+            park(nullptr);
+        }
+        _waiters.fetch_sub(1, std::memory_order_relaxed);
     }
 
-    void post(unsigned int n = 1) {
-#ifdef HAVE_SEM
-        while (n--) {
-            sem_post(&_sem);
+    // take one if the count is above zero, never blocks.
+    bool try_wait() {
+        int count = _count.load(std::memory_order_relaxed);
+        while (count > 0) {
+            if (_count.compare_exchange_weak(count, count - 1,
+                    std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
         }
-#else
-        std::unique_lock<std::mutex> lock(_mutex);
-        _count += n;
+        return false;
+    }
 
-        _condition.notify_all();
-        
-#endif // HAVE_SEM
+    // false if nothing could be taken in time.
+    template<typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) {
+        return wait_until(std::chrono::steady_clock::now() + timeout);
     }
 
-    void wait() {
-#ifdef HAVE_SEM
-        sem_wait(&_sem);
+    template<typename Clock, typename Duration>
+    bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (try_wait())
+            return true;
+        _waiters.fetch_add(1, std::memory_order_seq_cst);
+        bool taken;
+        while (!(taken = try_wait())) {
+            auto left = deadline - Clock::now();
+            if (left <= Duration::zero())
+                break;
+            std::chrono::nanoseconds ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+            park(&ns);
+        }
+        _waiters.fetch_sub(1, std::memory_order_relaxed);
+        return taken;
+    }
+private:
+#ifdef HAVE_FUTEX
+    // returns on a post, a timeout, a signal or when the count is not 0.
+    void park(const std::chrono::nanoseconds* timeout) {
+        struct timespec ts;
+        if (timeout) {
+            ts.tv_sec = (time_t)(timeout->count() / 1000000000);
+            ts.tv_nsec = (long)(timeout->count() % 1000000000);
+        }
+        syscall(SYS_futex, futexWord(), FUTEX_WAIT_PRIVATE, 0, timeout ? &ts : nullptr, nullptr, 0);
+    }
+
+    void wake(int n) {
+        syscall(SYS_futex, futexWord(), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+    }
+
+    int* futexWord() {
+        static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int");
+        return reinterpret_cast<int*>(&_count);
+    }
 #else
+    void park(const std::chrono::nanoseconds* timeout) {
         std::unique_lock<std::mutex> lock(_mutex);
-        while (_count == 0) {
+        if (_count.load(std::memory_order_relaxed) > 0)
+            return;
+        if (timeout)
+            _condition.wait_for(lock, *timeout);
+        else
             _condition.wait(lock);
-        }
-        --_count;
-#endif // HAVE_SEM
     }
 
+    void wake(int n) {
+        // the lock orders this against a sleeper between its check and wait.
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (n--) {
+            _condition.notify_one();
+        }
+    }
+#endif // HAVE_FUTEX
 private:
-#ifdef HAVE_SEM
-    sem_t _sem;
-#else
-    int _count;
+    std::atomic<int> _count;
+    std::atomic<int> _waiters;
+#ifndef HAVE_FUTEX
     std::mutex _mutex;
-    std::condition_variable_any _condition;
-#endif
-};
\ No newline at end of file
+    std::condition_variable _condition;
+#endif // HAVE_FUTEX
+};
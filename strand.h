@@ -0,0 +1,145 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <functional>
+
+#include "task.h"
+#include "future.h"
+#include "mpscQueue.h"
+
+namespace multi_thread {
+
+// Runs the tasks posted to it one at a time, in post order, on an
+// Executor (e.g. a ThreadPool), without locks:
+//
+//   Strand session(pool);
+//   session.post([&] { handle(request); });
+//
+// Tasks go into a lock-free MPSC queue; the post that finds the strand
+// idle also queues a drain task on the executor. The drain runs up to
+// batch tasks back to back on one worker, then either retires or
+// re-queues itself behind the pool's other work. No worker ever waits
+// for a strand. Tasks must not throw, as with ThreadPool::submit. The
+// strand must outlive its tasks: the destructor waits for them.
+class Strand {
+public:
+    explicit Strand(Executor& executor, int batch = 16)
+        : _executor(executor), _batch(batch > 0 ? batch : 1) {
+    }
+
+    Strand(const Strand&) = delete;
+    Strand& operator=(const Strand&) = delete;
+
+    ~Strand() {
+        while (_pending.load(std::memory_order_acquire) != 0) {
+            if (!_executor.runPendingTask())
+                std::this_thread::yield();
+        }
+    }
+
+    // any thread, also the strand's own tasks.
+    template<typename F>
+    void post(F&& f) {
+        Node* node = ::new (detail::StatePool<Node>::allocate()) Node(Task(std::forward<F>(f)));
+        // count first: a drain never pops more tasks than it was promised.
+        bool idle = _pending.fetch_add(1, std::memory_order_acq_rel) == 0;
+        _queue.push(node);
+        if (idle)
+            schedule();
+    }
+
+    // tasks posted and not finished, may be stale.
+    size_t pending() const {
+        return _pending.load(std::memory_order_relaxed);
+    }
+private:
+    struct Node : MpscNode {
+        explicit Node(Task&& t) : task(std::move(t)) {}
+        Task task;
+    };
+
+    // the drain queued on the executor. Dropped unrun (pool shutdown) it
+    // throws the strand's tasks away instead, so nothing waits forever.
+    class Drain {
+    public:
+        explicit Drain(Strand* strand) : _strand(strand) {}
+        Drain(Drain&& that) noexcept : _strand(that._strand) {
+            that._strand = nullptr;
+        }
+        Drain(const Drain&) = delete;
+        ~Drain() {
+            if (_strand)
+                _strand->drain(false);
+        }
+        void operator()() {
+            Strand* strand = _strand;
+            _strand = nullptr;
+            strand->drain(true);
+        }
+    private:
+        Strand* _strand;
+    };
+
+    void schedule() {
+        _executor.execute(Task(Drain(this)));
+    }
+
+    // only one drain runs at a time: _pending stays above zero from the
+    // post that scheduled it until it retires.
+    void drain(bool run) {
+        size_t done = 0;
+        while (!run || done < (size_t)_batch) {
+            Node* node = _queue.pop();
+            if (!node) {
+                // _pending promised a task, its post is halfway through.
+                if (done == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                break;
+            }
+            if (run)
+                node->task();
+            node->~Node();
+            detail::StatePool<Node>::deallocate(node);
+            ++done;
+            if (!run && done == _pending.load(std::memory_order_acquire))
+                break;
+        }
+        // more was posted meanwhile: go again, after the pool's other
+        // work. Otherwise the strand is idle and may be destroyed.
+        if (_pending.fetch_sub(done, std::memory_order_acq_rel) != done)
+            schedule();
+    }
+private:
+    Executor& _executor;
+    const int _batch;
+    std::atomic<size_t> _pending{0};
+    MpscQueue<Node> _queue;
+};
+
+
+// Per-key ordering over a fixed set of strands: tasks submitted with
+// equal keys run in order and never overlap, different keys usually run
+// in parallel (two keys may share a strand and then take turns).
+class StrandGroup {
+public:
+    explicit StrandGroup(Executor& executor, size_t strands = 64, int batch = 16) {
+        for (size_t i = 0; i < (strands > 0 ? strands : 1); ++i) {
+            _strands.emplace_back(new Strand(executor, batch));
+        }
+    }
+
+    template<typename Key, typename F>
+    void submit(const Key& key, F&& f) {
+        _strands[std::hash<Key>()(key) % _strands.size()]->post(std::forward<F>(f));
+    }
+private:
+    std::vector<std::unique_ptr<Strand>> _strands;
+};
+
+}// namespace
@@ -0,0 +1,265 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+
+namespace multi_thread {
+
+// Move-only void() callable used as the pool's task type.
+// Callables up to kInlineSize bytes are stored inside the Task itself, so
+// submitting a lambda with a few captures never touches the heap; bigger
+// ones fall back to a single allocation. Unlike std::function it accepts
+// move-only callables (lambdas holding std::unique_ptr, std::promise...).
+class Task {
+public:
+    static const size_t kInlineSize = 64;
+
+    Task() : _ops(nullptr), _queuedAt(0) {}
+
+    template<typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) : _ops(nullptr), _queuedAt(0) {
+        typedef typename std::decay<F>::type Fn;
+        if (isNull(f))
+            return;
+        init<Fn>(std::forward<F>(f), std::integral_constant<bool, fitsInline<Fn>()>());
+    }
+
+    Task(Task&& that) noexcept : _ops(that._ops), _queuedAt(that._queuedAt) {
+        if (_ops) {
+            _ops->move(&_storage, &that._storage);
+            that._ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& that) noexcept {
+        if (this != &that) {
+            reset();
+            _ops = that._ops;
+            _queuedAt = that._queuedAt;
+            if (_ops) {
+                _ops->move(&_storage, &that._storage);
+                that._ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    // whether a callable of type Fn is stored inline, without allocating.
+    template<typename Fn>
+    static constexpr bool fitsInline() {
+        return sizeof(Fn) <= kInlineSize
+            && alignof(Fn) <= alignof(Storage)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    ~Task() {
+        reset();
+    }
+
+    void operator()() {
+        _ops->invoke(&_storage);
+    }
+
+    explicit operator bool() const {
+        return _ops != nullptr;
+    }
+
+    void reset() {
+        if (_ops) {
+            _ops->destroy(&_storage);
+            _ops = nullptr;
+        }
+    }
+
+    // pool bookkeeping: when the task was queued, in steady_clock ticks,
+    // 0 when the pool did not record it. Lives in the padding after _ops.
+    int64_t queuedAt() const {
+        return _queuedAt;
+    }
+    void setQueuedAt(int64_t ticks) {
+        _queuedAt = ticks;
+    }
+private:
+    typedef typename std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type Storage;
+
+    struct Ops {
+        void (*invoke)(void* self);
+        // move-construct into dst and destroy src.
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* self);
+    };
+
+    // callable kept in _storage.
+    template<typename Fn>
+    struct InlineOps {
+        static void invoke(void* self) {
+            (*static_cast<Fn*>(self))();
+        }
+        static void move(void* dst, void* src) {
+            ::new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void destroy(void* self) {
+            static_cast<Fn*>(self)->~Fn();
+        }
+        static const Ops ops;
+    };
+
+    // _storage holds a Fn*.
+    template<typename Fn>
+    struct HeapOps {
+        static Fn*& ptr(void* self) {
+            return *static_cast<Fn**>(self);
+        }
+        static void invoke(void* self) {
+            (*ptr(self))();
+        }
+        static void move(void* dst, void* src) {
+            ::new (dst) Fn*(ptr(src));
+        }
+        static void destroy(void* self) {
+            delete ptr(self);
+        }
+        static const Ops ops;
+    };
+
+    template<typename Fn, typename F>
+    void init(F&& f, std::true_type) {
+        ::new (&_storage) Fn(std::forward<F>(f));
+        _ops = &InlineOps<Fn>::ops;
+    }
+
+    template<typename Fn, typename F>
+    void init(F&& f, std::false_type) {
+        ::new (&_storage) Fn*(new Fn(std::forward<F>(f)));
+        _ops = &HeapOps<Fn>::ops;
+    }
+
+    template<typename F>
+    static bool isNull(const F&) { return false; }
+    template<typename R, typename... A>
+    static bool isNull(const std::function<R(A...)>& f) { return !f; }
+    template<typename R, typename... A>
+    static bool isNull(R (*f)(A...)) { return f == nullptr; }
+private:
+    Storage _storage;
+    const Ops* _ops;
+    int64_t _queuedAt;
+};
+
+template<typename Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = {
+    &Task::InlineOps<Fn>::invoke, &Task::InlineOps<Fn>::move, &Task::InlineOps<Fn>::destroy
+};
+
+template<typename Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = {
+    &Task::HeapOps<Fn>::invoke, &Task::HeapOps<Fn>::move, &Task::HeapOps<Fn>::destroy
+};
+
+
+// A callable with its arguments, invoked once. Arguments are moved into
+// the call, so move-only arguments work.
+template<typename F, typename... Args>
+class BoundCall {
+public:
+    template<typename G, typename... A>
+    explicit BoundCall(G&& f, A&&... args)
+        : _f(std::forward<G>(f)), _args(std::forward<A>(args)...) {
+    }
+
+    auto operator()() -> decltype(std::declval<F&>()(std::declval<Args>()...)) {
+        return call(std::index_sequence_for<Args...>());
+    }
+private:
+    template<size_t... I>
+    auto call(std::index_sequence<I...>) -> decltype(std::declval<F&>()(std::declval<Args>()...)) {
+        return _f(std::move(std::get<I>(_args))...);
+    }
+private:
+    F _f;
+    std::tuple<Args...> _args;
+};
+
+template<typename F, typename... Args>
+BoundCall<typename std::decay<F>::type, typename std::decay<Args>::type...>
+bindCall(F&& f, Args&&... args) {
+    return BoundCall<typename std::decay<F>::type, typename std::decay<Args>::type...>(
+        std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+
+// Something that runs Tasks, implemented by BasicThreadPool.
+// Futures, continuations and helping waits only need this much of a pool.
+class Executor {
+public:
+    virtual ~Executor() {}
+    // queue t for execution.
+    virtual void execute(Task&& t) = 0;
+    // run one queued task on the calling thread, return false if none.
+    virtual bool runPendingTask() = 0;
+};
+
+
+// co_await ScheduleAwaiter(executor) (C++20) suspends the coroutine and
+// resumes it on the executor. The coroutine handle is queued as is, in
+// the Task's inline buffer. Written against any handle type, so this
+// header does not need <coroutine>. A handle the executor drops unrun
+// (pool shutdown, overflow) is resumed where it is dropped, and the
+// co_await throws, as a broken promise does.
+class ScheduleAwaiter {
+public:
+    explicit ScheduleAwaiter(Executor& executor) : _executor(executor), _dropped(false) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template<typename Handle>
+    void await_suspend(Handle h) {
+        _executor.execute(Task(Resume<Handle>(h, &_dropped)));
+    }
+
+    void await_resume() const {
+        if (_dropped)
+            throw std::runtime_error("schedule task dropped");
+    }
+private:
+    template<typename Handle>
+    class Resume {
+    public:
+        Resume(Handle h, bool* dropped) : _h(h), _dropped(dropped) {}
+        Resume(Resume&& that) noexcept : _h(that._h), _dropped(that._dropped) {
+            that._dropped = nullptr;
+        }
+        Resume(const Resume&) = delete;
+        ~Resume() {
+            if (_dropped) {
+                *_dropped = true;
+                _h.resume();
+            }
+        }
+        void operator()() {
+            _dropped = nullptr;
+            _h.resume();
+        }
+    private:
+        Handle _h;
+        // armed until run or moved from.
+        bool* _dropped;
+    };
+
+    Executor& _executor;
+    bool _dropped;
+};
+
+}// namespace
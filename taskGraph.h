@@ -0,0 +1,246 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+
+#include "task.h"
+#include "future.h"
+
+namespace multi_thread {
+
+// A dependency graph of tasks, built once and run any number of times.
+//
+//   TaskGraph graph;
+//   TaskGraph::Node fetch = graph.add([] { ... });
+//   TaskGraph::Node parse = graph.add([] { ... });
+//   graph.precede(fetch, parse);
+//   graph.run(pool).get();
+//
+// Each run resets an atomic in-degree per node from the edges. A finished
+// node releases its successors; the first one that becomes ready runs
+// right away on the same worker, the others are handed to the executor.
+// A node that throws fails the run: nodes not started yet are skipped and
+// the future returned by run() gets the first exception. One run at a
+// time; the graph can not be changed while it runs and must outlive the
+// run (the destructor waits for it).
+class TaskGraph {
+public:
+    typedef size_t Node;
+
+    TaskGraph() {}
+
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    ~TaskGraph() {
+        while (_running.load(std::memory_order_acquire)) {
+            if (!_executor->runPendingTask())
+                std::this_thread::yield();
+        }
+    }
+
+    // add a node running f (invoked once per run).
+    template<typename F>
+    Node add(F&& f) {
+        checkIdle();
+        _nodes.emplace_back(Task(std::forward<F>(f)));
+        _checked = false;
+        return _nodes.size() - 1;
+    }
+
+    // after only starts once before has finished.
+    void precede(Node before, Node after) {
+        checkIdle();
+        if (before >= _nodes.size() || after >= _nodes.size())
+            throw std::out_of_range("no such node");
+        _nodes[before].successors.push_back(after);
+        ++_nodes[after].inDegree;
+        _checked = false;
+    }
+
+    size_t size() const {
+        return _nodes.size();
+    }
+
+    bool running() const {
+        return _running.load(std::memory_order_acquire);
+    }
+
+    // run every node on executor, the future is ready once all of them
+    // have finished (or were skipped after a failure). Throws
+    // std::logic_error if the graph is running already or has a cycle.
+    Future<void> run(Executor& executor) {
+        if (_running.exchange(true, std::memory_order_acq_rel))
+            throw std::logic_error("graph is already running");
+        try {
+            check();
+        }
+        catch (...) {
+            _running.store(false, std::memory_order_release);
+            throw;
+        }
+        _executor = &executor;
+        _promise.reset(new Promise<void>(&executor));
+        Future<void> future = _promise->getFuture();
+        if (_nodes.empty()) {
+            complete();
+            return future;
+        }
+        _failed.store(false, std::memory_order_relaxed);
+        _error = nullptr;
+        for (size_t i = 0; i < _nodes.size(); ++i) {
+            _pending[i].store(_nodes[i].inDegree, std::memory_order_relaxed);
+        }
+        _remaining.store(_nodes.size(), std::memory_order_relaxed);
+        // handing the roots to the executor publishes the counters.
+        for (Node root : _roots) {
+            start(root);
+        }
+        return future;
+    }
+private:
+    static const Node kNone = ~(Node)0;
+
+    struct Vertex {
+        explicit Vertex(Task&& t) : work(std::move(t)) {}
+        Task work;
+        std::vector<Node> successors;
+        int inDegree = 0;
+    };
+
+    // a node queued on the executor. Destroyed unrun (overflow, pool
+    // shutdown) it fails the run rather than leaving it hanging.
+    class Step {
+    public:
+        Step(TaskGraph* graph, Node node) : _graph(graph), _node(node) {}
+        Step(Step&& that) noexcept : _graph(that._graph), _node(that._node) {
+            that._graph = nullptr;
+        }
+        Step(const Step&) = delete;
+        ~Step() {
+            if (_graph) {
+                _graph->fail(std::make_exception_ptr(std::runtime_error("graph task dropped")));
+                _graph->runFrom(_node);
+            }
+        }
+        void operator()() {
+            TaskGraph* graph = _graph;
+            _graph = nullptr;
+            graph->runFrom(_node);
+        }
+    private:
+        TaskGraph* _graph;
+        Node _node;
+    };
+
+    void checkIdle() const {
+        if (running())
+            throw std::logic_error("graph is running");
+    }
+
+    // find the roots and make sure every node can be reached (no cycle),
+    // once per change of the graph.
+    void check() {
+        if (_checked)
+            return;
+        std::vector<int> degree(_nodes.size());
+        std::vector<Node> order;
+        _roots.clear();
+        for (size_t i = 0; i < _nodes.size(); ++i) {
+            degree[i] = _nodes[i].inDegree;
+            if (degree[i] == 0)
+                _roots.push_back(i);
+        }
+        order = _roots;
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (Node s : _nodes[order[i]].successors) {
+                if (--degree[s] == 0)
+                    order.push_back(s);
+            }
+        }
+        if (order.size() != _nodes.size())
+            throw std::logic_error("task graph has a cycle");
+        _pending.reset(new std::atomic<int>[_nodes.size()]);
+        _checked = true;
+    }
+
+    void start(Node node) {
+        _executor->execute(Task(Step(this, node)));
+    }
+
+    // run node, then keep going with the first successor it made ready.
+    void runFrom(Node node) {
+        while (true) {
+            Vertex& v = _nodes[node];
+            if (!_failed.load(std::memory_order_relaxed)) {
+                try {
+                    v.work();
+                }
+                catch (...) {
+                    fail(std::current_exception());
+                }
+            }
+            Node next = kNone;
+            for (Node s : v.successors) {
+                if (_pending[s].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (next == kNone)
+                        next = s;
+                    else
+                        start(s);
+                }
+            }
+            // the last node to finish completes the run, and the graph may
+            // be gone right after.
+            if (_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                complete();
+                return;
+            }
+            if (next == kNone)
+                return;
+            node = next;
+        }
+    }
+
+    void fail(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(_errorMtx);
+        if (!_error)
+            _error = e;
+        _failed.store(true, std::memory_order_relaxed);
+    }
+
+    void complete() {
+        std::unique_ptr<Promise<void>> promise(std::move(_promise));
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(_errorMtx);
+            error = _error;
+        }
+        _running.store(false, std::memory_order_release);
+        // the graph may be run again or destroyed from here on.
+        if (error)
+            promise->setException(error);
+        else
+            promise->setValue();
+    }
+private:
+    std::vector<Vertex> _nodes;
+    std::vector<Node> _roots;
+    bool _checked = false;
+    // per run: predecessors of each node still to finish.
+    std::unique_ptr<std::atomic<int>[]> _pending;
+    std::atomic<size_t> _remaining{0};
+    std::atomic_bool _running{false};
+    std::atomic_bool _failed{false};
+    std::mutex _errorMtx;
+    std::exception_ptr _error;
+    Executor* _executor = nullptr;
+    std::unique_ptr<Promise<void>> _promise;
+};
+
+}// namespace
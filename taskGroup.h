@@ -0,0 +1,161 @@
+#pragma once
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <utility>
+#include <exception>
+#include <type_traits>
+#include <condition_variable>
+
+#include "task.h"
+
+namespace multi_thread {
+
+// A set of tasks run on an Executor (e.g. a ThreadPool) that can be
+// waited for as a whole.
+//
+//   TaskGroup group(pool);
+//   for (auto& part : parts)
+//       group.run([&part] { process(part); });
+//   group.wait();
+//
+// Outstanding tasks are tracked with one atomic counter. wait() runs the
+// executor's queued tasks on the calling thread while it waits, so a
+// fork-join inside a pool task does not block a worker. The first
+// exception thrown by a task cancels the group and is rethrown by
+// wait(). A task dropped unrun by the executor (overflow, shutdown)
+// still counts as finished. The group must outlive its tasks: the
+// destructor waits.
+class TaskGroup {
+public:
+    explicit TaskGroup(Executor& executor) : _executor(executor) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup() {
+        try {
+            wait();
+        }
+        catch (...) {
+        }
+    }
+
+    // run f() on the executor as part of the group. May be called from
+    // the group's own tasks.
+    template<typename F>
+    void run(F&& f) {
+        if (_count.fetch_add(1, std::memory_order_relaxed) == 0)
+            _rounds.fetch_add(1, std::memory_order_relaxed);
+        _executor.execute(Task(Member<typename std::decay<F>::type>(this, std::forward<F>(f))));
+    }
+
+    // wait for every task run so far, helping the executor meanwhile.
+    // Rethrows the first exception of a task; the group can be reused
+    // afterwards, cancellation is cleared.
+    void wait() {
+        while (_count.load(std::memory_order_acquire) != 0) {
+            if (_executor.runPendingTask())
+                continue;
+            std::unique_lock<std::mutex> lock(_mtx);
+            ++_waiters;
+            // timed, new work may show up in the executor while we sleep.
+            _cond.wait_for(lock, std::chrono::milliseconds(1), [this] {
+                return _count.load(std::memory_order_acquire) == 0;
+            });
+            --_waiters;
+        }
+        // the task that brought the count to zero may still be about to
+        // signal; it is done with the group once the round is counted.
+        std::unique_lock<std::mutex> lock(_mtx);
+        ++_waiters;
+        _cond.wait(lock, [this] { return _finished == _rounds.load(std::memory_order_relaxed); });
+        --_waiters;
+        _cancelled.store(false, std::memory_order_relaxed);
+        std::exception_ptr error = std::move(_error);
+        _error = nullptr;
+        lock.unlock();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // tasks of the group that have not started yet are skipped. wait()
+    // is still needed to know when the running ones are done.
+    void cancel() {
+        _cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool cancelled() const {
+        return _cancelled.load(std::memory_order_relaxed);
+    }
+
+    // tasks run and not finished yet.
+    int pending() const {
+        return (int)_count.load(std::memory_order_relaxed);
+    }
+private:
+    // f wrapped so that running or destroying it unrun finishes exactly
+    // once.
+    template<typename F>
+    class Member {
+    public:
+        template<typename G>
+        Member(TaskGroup* group, G&& f) : _group(group), _f(std::forward<G>(f)) {}
+        // noexcept as f's move, so Task keeps a member inline only when
+        // it may.
+        Member(Member&& that) noexcept(std::is_nothrow_move_constructible<F>::value)
+            : _group(that._group), _f(std::move(that._f)) {
+            that._group = nullptr;
+        }
+        Member(const Member&) = delete;
+        ~Member() {
+            if (_group)
+                _group->finish();
+        }
+        void operator()() {
+            TaskGroup* group = _group;
+            _group = nullptr;
+            if (!group->cancelled()) {
+                try {
+                    _f();
+                }
+                catch (...) {
+                    group->fail(std::current_exception());
+                }
+            }
+            group->finish();
+        }
+    private:
+        TaskGroup* _group;
+        F _f;
+    };
+
+    void fail(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (!_error)
+            _error = e;
+        _cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    void finish() {
+        if (_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        std::lock_guard<std::mutex> lock(_mtx);
+        ++_finished;
+        if (_waiters)
+            _cond.notify_all();
+    }
+private:
+    Executor& _executor;
+    std::atomic<int64_t> _count{0};
+    // times the count left zero, and (under _mtx) times it got back to it.
+    std::atomic<uint64_t> _rounds{0};
+    uint64_t _finished = 0;
+    std::atomic_bool _cancelled{false};
+    std::mutex _mtx;
+    std::condition_variable _cond;
+    int _waiters = 0;
+    std::exception_ptr _error;
+};
+
+}// namespace
@@ -0,0 +1,356 @@
+// Tests of the logger: lines going through an AsyncLogWriter, levels
+// checked before arguments are evaluated, LogContexts reused, cached
+// timestamps and prefix in formatted lines, and of the
+// binary log: arguments encoded and decoded back to text, and records
+// going through a BinaryLogWriter into a channel.
+//
+//   g++ -std=c++14 -O2 -pthread testLog.cpp binaryLog.cpp logger.cpp util.cpp file.cpp -o testLog
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <thread>
+#include <sstream>
+#include <iomanip>
+#include <future>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif // !_WIN32
+
+#include "binaryLog.h"
+
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+enum Color { Red, Green };
+enum class Offset : int8_t { Back = -3 };
+enum class Code : uint64_t { Big = 0xffffffffffffffffull };
+
+// what the writer would make of format and args.
+template<typename... Args>
+static std::string
+roundTrip(const char *format, const Args&... args) {
+    std::vector<char> buffer(binary_log::argsSize(binary_log::toArg(args)...));
+    char *end = binary_log::putArgs(buffer.data(), binary_log::toArg(args)...);
+    CHECK(end == buffer.data() + buffer.size());
+    std::ostringstream ost;
+    binary_log::decode(ost, format, buffer.data(), end);
+    return ost.str();
+}
+
+static void
+testRoundTrip() {
+    CHECK(roundTrip("plain") == "plain");
+    CHECK(roundTrip("{} {} {}", -7, 42u, (int64_t)-1) == "-7 42 -1");
+    CHECK(roundTrip("{}", 18446744073709551615ull) == "18446744073709551615");
+    CHECK(roundTrip("{} {}", (short)-2, (unsigned char)200) == "-2 200");
+    CHECK(roundTrip("{} {} {}", Green, Offset::Back, Code::Big) == "1 -3 18446744073709551615");
+    CHECK(roundTrip("{} {}", 3.25, 1.5f) == "3.25 1.5");
+    CHECK(roundTrip("{} {} {}", true, false, 'x') == "true false x");
+
+    std::string host = "example.org";
+    char buffer[] = "buf";
+    char *mutableString = buffer;
+    const char *nullString = nullptr;
+    CHECK(roundTrip("{}:{} {} [{}]", host, "literal", mutableString, nullString) == "example.org:literal buf []");
+    CHECK(roundTrip("{} {}", (void *)0x1234, nullptr) == "0x1234 0x0");
+
+    // missing arguments leave their "{}", extra ones are not written.
+    CHECK(roundTrip("a {} b {}", 1) == "a 1 b {}");
+    CHECK(roundTrip("{}", 1, 2) == "1");
+
+    std::string huge(binary_log::kMaxStringBytes + 100, 'z');
+    CHECK(roundTrip("{}", huge) == huge.substr(0, binary_log::kMaxStringBytes));
+}
+
+// keeps the text of every line it is given.
+class CaptureChannel : public LogChannel {
+public:
+    explicit CaptureChannel(LogLevel level = LTrace) : LogChannel("capture", level, false) {}
+    void write(const Logger &, const LogContextPtr &ctx) override {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _lines.push_back(ctx->str());
+    }
+    std::vector<std::string> lines() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _lines;
+    }
+private:
+    std::mutex _mtx;
+    std::vector<std::string> _lines;
+};
+
+static int
+counted(int &evaluated) {
+    return ++evaluated;
+}
+
+// a level no channel takes costs neither the line nor its arguments.
+static void
+testLevels() {
+    CHECK(!g_defaultLogger->enabled(LError));
+    auto channel = std::make_shared<CaptureChannel>(LInfo);
+    g_defaultLogger->addChannel(channel);
+    CHECK(!g_defaultLogger->enabled(LDebug));
+    CHECK(g_defaultLogger->enabled(LInfo));
+    CHECK(g_defaultLogger->enabled(LError));
+
+    int evaluated = 0;
+    TraceL << counted(evaluated);
+    DebugL << counted(evaluated);
+    CHECK(evaluated == 0);
+    InfoL << counted(evaluated);
+    CHECK(evaluated == 1);
+
+    // level changes on the channel and the logger are seen at once.
+    channel->setLevel(LTrace);
+    CHECK(g_defaultLogger->enabled(LTrace));
+    DebugL << counted(evaluated);
+    CHECK(evaluated == 2);
+    g_defaultLogger->setLevel(LWarn);
+    CHECK(!g_defaultLogger->enabled(LInfo));
+    InfoL << counted(evaluated);
+    CHECK(evaluated == 2);
+    CHECK(channel->lines() == (std::vector<std::string>{ "1", "2" }));
+
+    // no channel, nothing is enabled.
+    g_defaultLogger->delChannel("capture");
+    CHECK(!g_defaultLogger->enabled(LError));
+    ErrorL << counted(evaluated);
+    CHECK(evaluated == 2);
+}
+
+static LogContextPtr
+newContext() {
+    return LogContext::create(LInfo, __FILE__, __FUNCTION__, __LINE__);
+}
+
+// a thread gets its released contexts back, wiped, also when another
+// thread released them; one that outlives its thread is still freed.
+static void
+testContextPool() {
+    LogContextPtr ctx = newContext();
+    LogContext *first = ctx.get();
+    *ctx << std::hex << std::setw(8) << std::setfill('0') << 255;
+    CHECK(ctx->str() == "000000ff");
+    ctx.reset();
+    ctx = newContext();
+    CHECK(ctx.get() == first);
+    CHECK(ctx->str().empty());
+    *ctx << 255;
+    CHECK(ctx->str() == "255");
+
+    LogContextPtr second = newContext();
+    CHECK(second.get() != first);
+    LogContext *both[] = { ctx.get(), second.get() };
+    ctx.reset();
+    second.reset();
+    ctx = newContext();
+    second = newContext();
+    CHECK((ctx.get() == both[0] && second.get() == both[1]) || (ctx.get() == both[1] && second.get() == both[0]));
+    ctx.reset();
+    second.reset();
+
+    std::promise<LogContextPtr> handed;
+    std::promise<void> released;
+    LogContext *reused = nullptr;
+    std::thread owner([&] {
+        handed.set_value(newContext());
+        released.get_future().wait();
+        reused = newContext().get();
+    });
+    LogContextPtr remote = handed.get_future().get();
+    LogContext *sent = remote.get();
+    remote.reset();
+    released.set_value();
+    owner.join();
+    CHECK(reused == sent);
+
+    std::thread([&] { remote = newContext(); }).join();
+    *remote << "after its thread";
+    CHECK(remote->str() == "after its thread");
+    remote.reset();
+}
+
+// what formatTime() should make of tv, built from scratch.
+static std::string
+expectedTime(const timeval &tv) {
+    time_t second = tv.tv_sec;
+    struct tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &second);
+#else
+    localtime_r(&second, &tm);
+#endif // _WIN32
+    char text[64];
+    size_t n = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(text + n, sizeof(text) - n, ".%03d", (int)(tv.tv_usec / 1000));
+    return text;
+}
+
+// formats every line in full, without color.
+class FormatChannel : public LogChannel {
+public:
+    FormatChannel() : LogChannel("format") {}
+    void write(const Logger &logger, const LogContextPtr &ctx) override {
+        std::ostringstream ost;
+        format(logger, ost, ctx, false, true);
+        _line = ost.str();
+        _tv = ctx->_tv;
+    }
+    std::string _line;
+    timeval _tv;
+};
+
+// the cached time text follows the second and millisecond of every
+// call, forwards, backwards and per thread.
+static void
+testTimeCache() {
+    const time_t base = 1700000000;
+    const timeval times[] = {
+        { base, 0 }, { base, 999999 }, { base + 1, 5000 }, { base, 123000 },
+        { base + 86400, 42000 }, { base + 86400, 42999 }, { base + 86400, 43000 },
+    };
+    for (const timeval &tv : times) {
+        CHECK(LogChannel::printTime(tv) == expectedTime(tv));
+    }
+    std::thread([&] {
+        timeval other = { base + 3600, 7000 };
+        CHECK(LogChannel::printTime(other) == expectedTime(other));
+    }).join();
+    CHECK(LogChannel::printTime(times[0]) == expectedTime(times[0]));
+
+#ifdef _WIN32
+    std::string pid = std::to_string(GetCurrentProcessId());
+#else
+    std::string pid = std::to_string(getpid());
+#endif // _WIN32
+    Logger logger("named");
+    CHECK(logger.getPrefix() == "named[" + pid + "] ");
+    auto channel = std::make_shared<FormatChannel>();
+    g_defaultLogger->addChannel(channel);
+    int line = __LINE__; WarnL << "formatted";
+    g_defaultLogger->delChannel("format");
+    CHECK(channel->_line == expectedTime(channel->_tv) + " W " + g_defaultLogger->getPrefix()
+        + "testLog.cpp:" + std::to_string(line) + " testTimeCache | formatted\n");
+}
+
+// every thread's lines arrive, in order, also after the writer parked.
+static void
+testAsyncWriter() {
+    const int kThreads = 4;
+    const int kLines = 2000;
+    auto channel = std::make_shared<CaptureChannel>();
+    g_defaultLogger->addChannel(channel);
+    g_defaultLogger->setWriter(std::make_shared<AsyncLogWriter>());
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < kLines; ++i) {
+                InfoL << "thread " << t << " line " << i;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    // a line written to an idle, parked writer wakes it.
+    auto waitFor = [&](size_t n) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (channel->lines().size() < n && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return channel->lines().size() == n;
+    };
+    CHECK(waitFor((size_t)kThreads * kLines));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    WarnL << "late";
+    CHECK(waitFor((size_t)kThreads * kLines + 1));
+    // the last lines are flushed when the writer goes.
+    InfoL << "last";
+    g_defaultLogger->setWriter(nullptr);
+    g_defaultLogger->delChannel("capture");
+
+    std::vector<std::string> lines = channel->lines();
+    CHECK(lines.size() == (size_t)kThreads * kLines + 2);
+    CHECK(lines[kThreads * kLines] == "late");
+    CHECK(lines.back() == "last");
+    for (int t = 0; t < kThreads; ++t) {
+        int next = 0;
+        std::string prefix = "thread " + std::to_string(t) + " line ";
+        for (auto &line : lines) {
+            if (line.compare(0, prefix.size(), prefix) == 0) {
+                CHECK(line == prefix + std::to_string(next));
+                ++next;
+            }
+        }
+        CHECK(next == kLines);
+    }
+}
+
+static void
+testWriter() {
+    const int kThreads = 3;
+    const int kLines = 500;
+    auto channel = std::make_shared<CaptureChannel>();
+    g_defaultLogger->addChannel(channel);
+    {
+        BinaryLogWriter writer;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t) {
+            threads.emplace_back([t] {
+                for (int i = 0; i < kLines; ++i) {
+                    InfoB("thread {} line {}", t, i);
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        WarnB("from {}", std::string("main"));
+    }
+    g_defaultLogger->delChannel("capture");
+
+    // every record once, each thread's in order; nothing was dropped.
+    std::vector<std::string> lines = channel->lines();
+    CHECK(lines.size() == (size_t)kThreads * kLines + 1);
+    CHECK(std::find(lines.begin(), lines.end(), "from main") != lines.end());
+    for (int t = 0; t < kThreads; ++t) {
+        int next = 0;
+        std::string prefix = "thread " + std::to_string(t) + " line ";
+        for (auto &line : lines) {
+            if (line.compare(0, prefix.size(), prefix) == 0) {
+                CHECK(line == prefix + std::to_string(next));
+                ++next;
+            }
+        }
+        CHECK(next == kLines);
+    }
+}
+
+int main() {
+    std::thread([] {
+        std::this_thread::sleep_for(std::chrono::seconds(60));
+        fprintf(stderr, "timed out\n");
+        abort();
+    }).detach();
+
+    testLevels();
+    testContextPool();
+    testTimeCache();
+    testAsyncWriter();
+    testRoundTrip();
+    testWriter();
+    printf("all passed\n");
+    return 0;
+}
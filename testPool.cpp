@@ -0,0 +1,792 @@
+// Tests of the pool, of what is built on it and of Semaphore. A failed
+// check prints its line and aborts, a watchdog aborts a run that hangs.
+//
+//   g++ -std=c++14 -O2 -pthread testPool.cpp affinity.cpp -o testPool
+//
+// Built as C++20 it also covers coroutine scheduling.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <random>
+#include <numeric>
+#include <stdexcept>
+
+#include "threadPool.h"
+#include "parallelAlgorithm.h"
+#include "timerWheel.h"
+#include "taskGroup.h"
+#include "taskGraph.h"
+#include "strand.h"
+#include "channel.h"
+#include "semaphore.h"
+#if __cplusplus >= 202002L
+#include "coroutine.h"
+#endif
+
+
+using namespace multi_thread;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+// drops every task unrun, as a full or stopped pool does.
+class DropExecutor : public Executor {
+public:
+    void execute(Task&& t) override {
+        Task dropped(std::move(t));
+        ++_dropped;
+    }
+    bool runPendingTask() override {
+        return false;
+    }
+    int dropped() const {
+        return _dropped;
+    }
+private:
+    int _dropped = 0;
+};
+
+// a queue that always looks empty, so parallel_for splits on every
+// chunk and its pushes keep running into a full queue.
+template<typename T>
+class HungryQueue : public ThreadSafeQueue<T> {
+public:
+    using ThreadSafeQueue<T>::ThreadSafeQueue;
+    bool empty() const {
+        return true;
+    }
+};
+
+static void
+testAsync() {
+    ThreadPool pool(2);
+    Future<int> sum = pool.async([](int a, int b) { return a + b; }, 40, 2);
+    CHECK(sum.get() == 42);
+    Future<std::string> text = pool.async([] { return 7; }).then([](int v) { return std::to_string(v * 6); });
+    CHECK(text.get() == "42");
+
+    // an exception skips the continuation and reaches get().
+    bool continued = false;
+    Future<void> failed = pool.async([]() -> int { throw std::runtime_error("boom"); })
+        .then([&](int) { continued = true; });
+    bool thrown = false;
+    try {
+        failed.get();
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(!continued);
+
+    // a task carrying a promise stays in Task's inline buffer.
+    Promise<int> promise;
+    auto work = [promise = std::move(promise)]() mutable { promise.setValue(1); };
+    static_assert(Task::fitsInline<decltype(work)>(), "promise tasks should not allocate");
+}
+
+// tasks a worker submits go to its own deque; with the owner held up
+// they can only run by being stolen.
+static void
+testWorkStealing() {
+    ThreadPool pool(4, ScheduleMode::WorkStealing);
+    const int kChildren = 200;
+    std::atomic<int> done(0);
+    std::atomic<bool> finished(false);
+    pool.submit([&] {
+        for (int i = 0; i < kChildren; ++i) {
+            pool.submit([&, i] {
+                // and one more level, from the thief's deque.
+                pool.submit([&] { ++done; }, i % 2 == 0);
+                ++done;
+            });
+        }
+        while (done != 2 * kChildren) {
+            std::this_thread::yield();
+        }
+        finished = true;
+    });
+    while (!finished) {
+        std::this_thread::yield();
+    }
+    CHECK(pool.snapshot().total.steals >= (uint64_t)kChildren);
+}
+
+static void
+testParallelFor() {
+    ThreadPool pool(4);
+    std::vector<int> hits(10000, 0);
+    pool.parallel_for(0, (int)hits.size(), [&](int i) { ++hits[i]; }, 7);
+    for (int n : hits) {
+        CHECK(n == 1);
+    }
+
+    bool thrown = false;
+    try {
+        pool.parallel_for(0, 1000, [](int i) {
+            if (i == 500)
+                throw std::runtime_error("boom");
+        });
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+// runs f at level on a pool whose one worker is held by a gate task,
+// recording the order tasks start in.
+class PriorityRun {
+public:
+    explicit PriorityRun(ThreadPool& pool) : _pool(pool), _started(false), _open(false), _queued(0), _ran(0) {
+        _pool.submit([this] {
+            _started = true;
+            while (!_open) {
+                std::this_thread::yield();
+            }
+        });
+        while (!_started) {
+            std::this_thread::yield();
+        }
+    }
+    void submit(Priority level, int tag) {
+        ++_queued;
+        _pool.submit(level, [this, tag] {
+            _order.push_back(tag);
+            ++_ran;
+        });
+    }
+    // open the gate, return the order once all tasks ran.
+    std::vector<int> finish() {
+        _open = true;
+        while (_ran != _queued) {
+            std::this_thread::yield();
+        }
+        return _order;
+    }
+private:
+    ThreadPool& _pool;
+    std::atomic<bool> _started;
+    std::atomic<bool> _open;
+    int _queued;
+    std::atomic<int> _ran;
+    std::vector<int> _order;
+};
+
+// higher levels first, FIFO within a level; with aging a task that has
+// waited long enough overtakes newer higher ones.
+static void
+testPriority() {
+    ThreadPool pool(1);
+    {
+        PriorityRun run(pool);
+        for (int level = kPriorityLevels - 1; level >= 0; --level) {
+            run.submit((Priority)level, level * 2);
+            run.submit((Priority)level, level * 2 + 1);
+        }
+        std::vector<int> order = run.finish();
+        CHECK((int)order.size() == kPriorityLevels * 2);
+        for (int i = 0; i < (int)order.size(); ++i) {
+            CHECK(order[i] == i);
+        }
+    }
+    {
+        PriorityRun run(pool);
+        run.submit(kPriorityNormal, 0);
+        run.submit(kPriorityHigh, 1);
+        run.submit(kPriorityHighest, 2);
+        run.submit(kPriorityLowest, 3);
+        std::vector<int> order = run.finish();
+        CHECK((order == std::vector<int>{ 2, 1, 0, 3 }));
+    }
+
+    pool.setAging(std::chrono::milliseconds(1));
+    {
+        PriorityRun run(pool);
+        run.submit(kPriorityLowest, 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        run.submit(kPriorityHighest, 1);
+        run.submit(kPriorityHighest, 2);
+        std::vector<int> order = run.finish();
+        CHECK((order == std::vector<int>{ 0, 1, 2 }));
+    }
+    pool.setAging(std::chrono::microseconds(0));
+    {
+        PriorityRun run(pool);
+        run.submit(kPriorityLowest, 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        run.submit(kPriorityHighest, 1);
+        std::vector<int> order = run.finish();
+        CHECK((order == std::vector<int>{ 1, 0 }));
+    }
+}
+
+// every element runs once whatever the pool does with the splits.
+static void
+testParallelForOverflow() {
+    const Overflow policies[] = { Overflow::Block, Overflow::Reject, Overflow::CallerRuns, Overflow::DropOldest };
+    for (Overflow policy : policies) {
+        PoolOptions options;
+        options.capacity = 1;
+        options.overflow = policy;
+        options.blockTimeout = std::chrono::milliseconds(1);
+        BasicThreadPool<HungryQueue> pool(options);
+        // other work competing for the one slot.
+        std::atomic<bool> stop(false);
+        std::thread producer([&] {
+            while (!stop) {
+                pool.submit([] {});
+                std::this_thread::yield();
+            }
+        });
+        std::vector<std::atomic<int>> hits(20000);
+        for (auto& n : hits) {
+            n = 0;
+        }
+        pool.parallel_for(0, (int)hits.size(), [&](int i) { ++hits[i]; });
+        stop = true;
+        producer.join();
+        for (auto& n : hits) {
+            CHECK(n == 1);
+        }
+    }
+}
+
+// 2x2 matrices under multiplication mod 2^32: associative, not commutative.
+struct Matrix {
+    uint32_t a, b, c, d;
+    bool operator==(const Matrix& that) const {
+        return a == that.a && b == that.b && c == that.c && d == that.d;
+    }
+};
+
+static Matrix
+multiply(const Matrix& x, const Matrix& y) {
+    return Matrix{ x.a * y.a + x.b * y.c, x.a * y.b + x.b * y.d,
+                   x.c * y.a + x.d * y.c, x.c * y.b + x.d * y.d };
+}
+
+// sizes one below, at and one above a single chunk of T, then an odd
+// and an even number of chunks.
+template<typename T>
+static std::vector<size_t>
+sizesAround(const ThreadPool& pool) {
+    size_t grain = detail::chunkSize<T>(0, pool.threadCount());
+    return { 0, 1, grain - 1, grain, grain + 1, 4 * grain + 3, 200000 };
+}
+
+// sort and scan agree with std::sort and std::partial_sum.
+static void
+testParallelAlgorithms() {
+    ThreadPool pool(3);
+    std::mt19937 rng(7);
+    for (size_t n : sizesAround<int>(pool)) {
+        // distinct values, then few values with lots of ties.
+        for (uint32_t range : { 0u, 4u }) {
+            std::vector<int> v(n);
+            for (auto& x : v) {
+                x = range ? (int)(rng() % range) : (int)rng();
+            }
+            std::vector<int> expected = v;
+            std::sort(expected.begin(), expected.end());
+            std::vector<int> sorted = v;
+            parallel_sort(pool, sorted.begin(), sorted.end());
+            CHECK(sorted == expected);
+
+            std::sort(expected.begin(), expected.end(), std::greater<int>());
+            sorted = v;
+            parallel_sort(pool, sorted.begin(), sorted.end(), std::greater<int>());
+            CHECK(sorted == expected);
+        }
+    }
+
+    for (size_t n : sizesAround<Matrix>(pool)) {
+        std::vector<Matrix> m(n);
+        // shears have determinant 1, so products never wear down to 0.
+        for (auto& x : m) {
+            uint32_t r = (uint32_t)rng();
+            x = r & 1 ? Matrix{ 1, r, 0, 1 } : Matrix{ 1, 0, r, 1 };
+        }
+        std::vector<Matrix> expected(n);
+        std::partial_sum(m.begin(), m.end(), expected.begin(), multiply);
+        std::vector<Matrix> scanned(n);
+        CHECK(parallel_inclusive_scan(pool, m.begin(), m.end(), scanned.begin(), multiply) == scanned.end());
+        CHECK(scanned == expected);
+        // in place.
+        parallel_inclusive_scan(pool, m.begin(), m.end(), m.begin(), multiply);
+        CHECK(m == expected);
+    }
+}
+
+// an elastic pool scaling from zero runs every task, also one submitted
+// while the last worker is retiring.
+static void
+testElastic() {
+    PoolOptions options;
+    options.minThreads = 0;
+    options.maxThreads = 1;
+    options.keepAlive = std::chrono::milliseconds(1);
+    std::atomic<int> grown(0);
+    std::atomic<int> ran(0);
+    std::atomic<int> late(0);
+    std::atomic<bool> armed(false);
+    ThreadPool* self = nullptr;
+    // the last worker reports after its last look at the queues: a
+    // submit from there lands in the window where it is on its way out,
+    // and no later submit comes to the rescue.
+    options.onScale = [&](const ScaleEvent& e) {
+        if (e.reason != ScaleReason::IdleTimeout)
+            ++grown;
+        else if (e.threads == 0 && armed.exchange(false)) {
+            ++late;
+            self->submit([&] { ++ran; });
+        }
+    };
+    ThreadPool pool(options);
+    self = &pool;
+    auto settled = [&](int submitted) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (ran != submitted + late && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        return ran == submitted + late;
+    };
+    int submitted = 0;
+    std::mt19937 random(11);
+    for (int round = 0; round < 200; ++round) {
+        std::vector<std::thread> submitters;
+        for (int t = 0; t < 2; ++t) {
+            submitters.emplace_back([&] { pool.submit([&] { ++ran; }); });
+        }
+        for (auto& t : submitters) {
+            t.join();
+        }
+        submitted += 2;
+        CHECK(settled(submitted));
+        // around keepAlive, so submits meet workers on their way out.
+        std::this_thread::sleep_for(std::chrono::microseconds(random() % 2000));
+    }
+    // wait for the workers to retire before arming.
+    while (pool.threadCount() != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    armed = true;
+    pool.submit([&] { ++ran; });
+    ++submitted;
+    while (late == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(settled(submitted));
+    CHECK(grown > 1);
+}
+
+// every placement runs tasks, also when cpus names no CPU we have.
+static void
+testPlacement() {
+    const Placement placements[] = { Placement::None, Placement::Cpu, Placement::SpreadNodes, Placement::PackNodes };
+    for (Placement placement : placements) {
+        for (int cpu : { 0, 999 }) {
+            PoolOptions options;
+            options.minThreads = options.maxThreads = 2;
+            options.placement = placement;
+            options.cpus = { cpu };
+            ThreadPool pool(options);
+            std::atomic<int> ran(0);
+            {
+                TaskGroup group(pool);
+                for (int i = 0; i < 100; ++i) {
+                    group.run([&] { ++ran; });
+                }
+            }
+            CHECK(ran == 100);
+        }
+    }
+}
+
+// stepping straight to nextExpiry() every timer fires in the tick it is
+// due, also the ones filed in an upper level first.
+static void
+testSemaphore() {
+    Semaphore sem(2);
+    CHECK(sem.try_wait());
+    CHECK(sem.try_wait());
+    CHECK(!sem.try_wait());
+    sem.post(3);
+    for (int i = 0; i < 3; ++i) {
+        CHECK(sem.try_wait());
+    }
+    CHECK(!sem.try_wait());
+
+    // a timed wait on zero gives up no earlier than asked.
+    auto start = std::chrono::steady_clock::now();
+    CHECK(!sem.wait_for(std::chrono::milliseconds(20)));
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+    std::thread poster([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        sem.post();
+    });
+    CHECK(sem.wait_for(std::chrono::seconds(10)));
+    poster.join();
+
+    // one batched post releases every blocked waiter, and no more.
+    const int kWaiters = 4;
+    std::atomic<int> woken(0);
+    std::vector<std::thread> waiters;
+    for (int i = 0; i < kWaiters; ++i) {
+        waiters.emplace_back([&] {
+            sem.wait();
+            ++woken;
+        });
+    }
+    sem.post(kWaiters);
+    for (auto& t : waiters) {
+        t.join();
+    }
+    CHECK(woken == kWaiters);
+    CHECK(!sem.try_wait());
+
+    // every post is taken exactly once.
+    const int kPosts = 20000;
+    std::atomic<int> taken(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 2; ++i) {
+        threads.emplace_back([&] {
+            for (int n = 0; n < kPosts; ++n) {
+                sem.post();
+            }
+        });
+        threads.emplace_back([&] {
+            for (int n = 0; n < kPosts; ++n) {
+                if (n % 2)
+                    sem.wait();
+                else
+                    CHECK(sem.wait_for(std::chrono::seconds(10)));
+                ++taken;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    CHECK(taken == 2 * kPosts);
+    CHECK(!sem.try_wait());
+}
+
+static void
+testTimerWheel() {
+    typedef TimerWheel::Clock Clock;
+    TimerWheel wheel;
+    Clock::time_point base = Clock::now();
+    std::vector<Clock::duration> offsets = { std::chrono::milliseconds(255), std::chrono::milliseconds(300) };
+    std::mt19937 random(7);
+    for (int i = 0; i < 3000; ++i) {
+        offsets.push_back(std::chrono::microseconds(random() % 100000000));
+    }
+    std::vector<Clock::time_point> fired(offsets.size());
+    Clock::time_point now = base;
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        wheel.add(base + offsets[i], Task([&fired, &now, i] { fired[i] = now; }));
+    }
+    std::vector<Task> due;
+    while (wheel.size() != 0) {
+        Clock::time_point next = wheel.nextExpiry();
+        CHECK(next != Clock::time_point::max());
+        now = std::max(now, next);
+        wheel.expire(now, due);
+        for (auto& t : due) {
+            t();
+        }
+        due.clear();
+    }
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        Clock::time_point when = base + offsets[i];
+        CHECK(fired[i] >= when);
+        CHECK(fired[i] - when < std::chrono::milliseconds(1));
+    }
+}
+
+static void
+testTimers() {
+    ThreadPool pool(2);
+    std::atomic<int> once(0);
+    std::atomic<int> cancelled(0);
+    pool.submitAfter(std::chrono::milliseconds(300), [&] { ++once; });
+    TimerId id = pool.submitAfter(std::chrono::milliseconds(50), [&] { ++cancelled; });
+    CHECK(pool.cancelTimer(id));
+    CHECK(!pool.cancelTimer(id));
+
+    // runs of a periodic timer that outlast its period never overlap.
+    std::atomic<int> runs(0);
+    std::atomic<int> inside(0);
+    bool overlapped = false;
+    TimerId every = pool.submitEvery(std::chrono::milliseconds(1), [&] {
+        if (inside.fetch_add(1) != 0)
+            overlapped = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        inside.fetch_sub(1);
+        ++runs;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    CHECK(pool.cancelTimer(every));
+    CHECK(once == 1);
+    CHECK(cancelled == 0);
+    CHECK(runs > 1);
+    CHECK(!overlapped);
+}
+
+static void
+testTaskGroup() {
+    ThreadPool pool(4);
+    std::atomic<int> sum(0);
+    {
+        TaskGroup group(pool);
+        for (int i = 1; i <= 100; ++i) {
+            group.run([&sum, i] { sum += i; });
+        }
+        group.wait();
+        CHECK(sum == 5050);
+
+        group.run([] { throw std::runtime_error("boom"); });
+        bool thrown = false;
+        try {
+            group.wait();
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+
+    // a callable whose move may throw still runs, from the heap.
+    struct ThrowingMove {
+        std::atomic<int>* sum;
+        explicit ThrowingMove(std::atomic<int>* s) : sum(s) {}
+        ThrowingMove(const ThrowingMove& that) : sum(that.sum) {}
+        ThrowingMove(ThrowingMove&& that) noexcept(false) : sum(that.sum) {}
+        void operator()() {
+            *sum += 1;
+        }
+    };
+    {
+        sum = 0;
+        TaskGroup group(pool);
+        for (int i = 0; i < 10; ++i) {
+            group.run(ThrowingMove(&sum));
+        }
+        group.wait();
+        CHECK(sum == 10);
+    }
+
+    // dropped members count as finished, wait() returns.
+    DropExecutor drop;
+    std::atomic<int> ran(0);
+    TaskGroup group(drop);
+    for (int i = 0; i < 3; ++i) {
+        group.run([&] { ++ran; });
+    }
+    group.wait();
+    CHECK(ran == 0);
+    CHECK(group.pending() == 0);
+    CHECK(drop.dropped() == 3);
+}
+
+static void
+testTaskGraph() {
+    ThreadPool pool(4);
+    std::mutex mtx;
+    std::string order;
+    auto step = [&](char c) {
+        return [&, c] {
+            std::lock_guard<std::mutex> lock(mtx);
+            order += c;
+        };
+    };
+    TaskGraph graph;
+    TaskGraph::Node a = graph.add(step('a'));
+    TaskGraph::Node b = graph.add(step('b'));
+    TaskGraph::Node c = graph.add(step('c'));
+    graph.precede(a, b);
+    graph.precede(b, c);
+    for (int run = 0; run < 3; ++run) {
+        order.clear();
+        graph.run(pool).get();
+        CHECK(order == "abc");
+    }
+
+    // a dropped node fails the run instead of leaving it hanging.
+    DropExecutor drop;
+    order.clear();
+    bool thrown = false;
+    try {
+        graph.run(drop).get();
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(order.empty());
+    CHECK(!graph.running());
+}
+
+static void
+testStrand() {
+    ThreadPool pool(4);
+    const int kPerThread = 2000;
+    std::vector<int> seen[2];
+    std::atomic<int> inside(0);
+    bool overlapped = false;
+    {
+        Strand strand(pool, 4);
+        std::vector<std::thread> posters;
+        for (int t = 0; t < 2; ++t) {
+            posters.emplace_back([&, t] {
+                for (int i = 0; i < kPerThread; ++i) {
+                    strand.post([&, t, i] {
+                        if (inside.fetch_add(1) != 0)
+                            overlapped = true;
+                        seen[t].push_back(i);
+                        inside.fetch_sub(1);
+                    });
+                }
+            });
+        }
+        for (auto& t : posters) {
+            t.join();
+        }
+    }
+    CHECK(!overlapped);
+    for (auto& s : seen) {
+        CHECK((int)s.size() == kPerThread);
+        for (int i = 0; i < kPerThread; ++i) {
+            CHECK(s[i] == i);
+        }
+    }
+
+    // a dropped drain throws the tasks away, the destructor returns.
+    DropExecutor drop;
+    int ran = 0;
+    {
+        Strand strand(drop);
+        for (int i = 0; i < 5; ++i) {
+            strand.post([&] { ++ran; });
+        }
+        CHECK(strand.pending() == 0);
+    }
+    CHECK(ran == 0);
+}
+
+static void
+testChannel() {
+    Channel<int> ch(4);
+    CHECK(ch.send(1));
+    CHECK(ch.send(2));
+    ch.close();
+    CHECK(!ch.send(3));
+    int v = 0;
+    CHECK(ch.recv(v) && v == 1);
+    CHECK(ch.recv(v) && v == 2);
+    CHECK(!ch.recv(v));
+
+    // close wakes a blocked receiver.
+    Channel<std::string, ChannelMode::Spsc> spsc(2);
+    std::thread closer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        spsc.close();
+    });
+    std::string s;
+    CHECK(!spsc.recv(s));
+    closer.join();
+}
+
+static void
+testSelect() {
+    const int kCount = 1000;
+    Channel<int> odd(8);
+    Channel<int> even(8);
+    std::thread producer([&] {
+        for (int i = 0; i < kCount; ++i) {
+            CHECK((i % 2 ? odd : even).send(i));
+        }
+        odd.close();
+        even.close();
+    });
+    long sum = 0;
+    int fromOdd = 0;
+    int fromEven = 0;
+    Select select;
+    select.recv(odd, [&](int i) { CHECK(i % 2 == 1); sum += i; ++fromOdd; })
+          .recv(even, [&](int i) { CHECK(i % 2 == 0); sum += i; ++fromEven; });
+    int r;
+    while ((r = select.wait()) != Select::kClosed) {
+        CHECK(r == 0 || r == 1);
+    }
+    producer.join();
+    CHECK(fromOdd == kCount / 2 && fromEven == kCount / 2);
+    CHECK(sum == (long)kCount * (kCount - 1) / 2);
+
+    Channel<int> idle(2);
+    Select timed;
+    timed.recv(idle, [](int) {});
+    CHECK(timed.wait_for(std::chrono::milliseconds(5)) == Select::kTimeout);
+    idle.close();
+    CHECK(timed.wait() == Select::kClosed);
+}
+
+#if __cplusplus >= 202002L
+static coro::Task<int>
+hop(Executor& executor) {
+    try {
+        co_await ScheduleAwaiter(executor);
+    }
+    catch (const std::runtime_error&) {
+        co_return -1;
+    }
+    co_return 1;
+}
+
+static void
+testSchedule() {
+    ThreadPool pool(2);
+    CHECK(coro::spawn(pool, hop(pool)).get() == 1);
+    // resumed with an exception when the hop is dropped.
+    DropExecutor drop;
+    CHECK(coro::spawn(pool, hop(drop)).get() == -1);
+}
+#endif
+
+int main() {
+    std::thread([] {
+        std::this_thread::sleep_for(std::chrono::seconds(120));
+        fprintf(stderr, "timed out\n");
+        abort();
+    }).detach();
+
+    testAsync();
+    testWorkStealing();
+    testParallelFor();
+    testPriority();
+    testParallelForOverflow();
+    testParallelAlgorithms();
+    testElastic();
+    testPlacement();
+    testSemaphore();
+    testTimerWheel();
+    testTimers();
+    testTaskGroup();
+    testTaskGraph();
+    testStrand();
+    testChannel();
+    testSelect();
+#if __cplusplus >= 202002L
+    testSchedule();
+#endif
+    printf("all passed\n");
+    return 0;
+}
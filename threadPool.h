@@ -4,122 +4,1509 @@
 #include <functional>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <exception>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+#include "task.h"
+#include "ringQueue.h"
+#include "future.h"
+#include "timerWheel.h"
+#include "affinity.h"
+#include "poolStats.h"
 
 namespace multi_thread {
 
+// Priority levels, 0 runs first. submit(f, true) uses kPriorityHighest,
+// plain submit(f) kPriorityNormal.
+enum Priority {
+    kPriorityHighest = 0,
+    kPriorityHigher,
+    kPriorityHigh,
+    kPriorityAboveNormal,
+    kPriorityNormal,
+    kPriorityBelowNormal,
+    kPriorityLow,
+    kPriorityLowest
+};
+
+static const int kPriorityLevels = kPriorityLowest + 1;
+
+// index of the lowest set bit, x must not be 0.
+inline int lowestBit(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctz(x);
+#endif // _MSC_VER
+}
+
+// index of the highest set bit, x must not be 0.
+inline int highestBit(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, x);
+    return (int)index;
+#else
+    return 31 - __builtin_clz(x);
+#endif // _MSC_VER
+}
+
+// hint to the CPU that we are in a spin loop.
+inline void cpuRelax() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Task queue with kPriorityLevels FIFO levels.
+// A bitmap of non-empty levels finds the highest one in O(1). With aging
+// enabled a task moves up one level for every aging interval it has
+// waited, so sustained high-priority load can not starve the rest; only
+// the head of each non-empty level is looked at, still O(1).
+//
+// A worker that finds the queue empty first spins on the (atomic) size
+// with pause instructions, then yields a few times, and only then parks
+// on the condition variable. The spin budget follows the arrival gaps
+// it observes: it grows when a task showed up near the end of the
+// budget and halves when spinning came up empty. At most maxSpinners
+// workers spin at once; a push that finds enough spinners for all queued
+// tasks does not notify at all.
 template<typename Task>
 class ThreadSafeQueue {
 public:
+    typedef std::chrono::steady_clock Clock;
+
     ThreadSafeQueue() : _done(false) {
 
     }
 
+    // push a Task to the back of level's FIFO. Return false, leaving t
+    // alone, when the queue holds capacity tasks (unbounded by default).
+    bool push(Task&& t, int level) {
+        level = clampLevel(level);
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_size.load(std::memory_order_relaxed) >= _capacity)
+                return false;
+            _levels[level].emplace_back(std::move(t), stamp());
+            _nonEmpty |= 1u << level;
+            addSize(1);
+            wake = _waiting > 0 && uncovered() > 0;
+        }
+        if (wake)
+            _ready.notify_one();
+        return true;
+    }
+
     // push a Task to queue's back.
-    void push_back(const Task& t) {
-        std::lock_guard<std::mutex> lock(_mtx);
-        _queue.push_back(t);
-        _ready.notify_one();
+    bool push_back(Task&& t) {
+        return push(std::move(t), kPriorityNormal);
     }
 
-    // push a Task to queue's front.
-    void push_front(const Task& t) {
-        std::lock_guard<std::mutex> lock(_mtx);
-        _queue.push_front(t);
-        _ready.notify_one();
+    // push a Task ahead of normal ones, FIFO among priority tasks.
+    bool push_front(Task&& t) {
+        return push(std::move(t), kPriorityHighest);
+    }
+
+    // move [first, last) to queue's back under one lock, then wake at most
+    // one waiting worker per task. Return the number of tasks queued,
+    // short of the whole range when capacity is reached.
+    template<typename It>
+    size_t push_batch(It first, It last) {
+        size_t n = 0;
+        int wake;
+        size_t spare;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            Clock::time_point now = stamp();
+            std::deque<Entry>& level = _levels[kPriorityNormal];
+            size_t size = _size.load(std::memory_order_relaxed);
+            size_t room = size < _capacity ? _capacity - size : 0;
+            for (; first != last && n < room; ++first, ++n) {
+                level.emplace_back(Task(std::move(*first)), now);
+            }
+            if (n) {
+                _nonEmpty |= 1u << kPriorityNormal;
+                addSize(n);
+            }
+            wake = _waiting;
+            spare = uncovered();
+        }
+        notify(n < spare ? n : spare, wake);
+        return n;
     }
 
     // get a task from queue.
     void getTask(Task& t) {
+        spin(_epoch.load());
         std::unique_lock<std::mutex> lock(_mtx);
         // queue is empty() and not done, wait until queue has task.
-        if (_queue.empty() && !_done)
-            _ready.wait(lock);
+        ++_waiting;
+        _ready.wait(lock, [this] { return _size != 0 || _done; });
+        --_waiting;
         if (_done)
             return;
         // queue has task and not done.
-        t = _queue.front();
-        _queue.pop_front();
+        pop(t);
     }
 
-    bool empty()const {
+    // get a task from queue, also return when someone calls wakeOne()
+    // after epoch() returned seen, or at deadline. Used by workers that
+    // have other places to look for work (e.g. the work-stealing deques)
+    // or timers to run.
+    void getTask(Task& t, unsigned seen, Clock::time_point deadline = Clock::time_point::max()) {
+        spin(seen);
+        std::unique_lock<std::mutex> lock(_mtx);
+        auto ready = [&] {
+            return _size != 0 || _done || _epoch.load() != seen;
+        };
+        ++_waiting;
+        if (deadline == Clock::time_point::max())
+            _ready.wait(lock, ready);
+        else
+            _ready.wait_until(lock, deadline, ready);
+        --_waiting;
+        if (_done || _size == 0)
+            return;
+        pop(t);
+    }
+
+    // get a task from queue without waiting.
+    bool tryPop(Task& t) {
         std::lock_guard<std::mutex> lock(_mtx);
-        return _queue.empty();
+        if (_size == 0 || _done)
+            return false;
+        pop(t);
+        return true;
     }
 
-    int size() const {
+    unsigned epoch() const {
+        return _epoch.load();
+    }
+
+    // wake one waiter though no task was pushed to this queue.
+    void wakeOne() {
+        wake(1);
+    }
+
+    // as wakeOne(), for up to n waiters. Spinners see the epoch change
+    // by themselves and are not counted. Only takes the lock when some
+    // worker is parked, so the push of a busy pool stays lock-free here.
+    void wake(size_t n) {
+        // seq_cst against ++_waiting in getTask(): either we see the
+        // waiter, or it sees the new epoch before it sleeps.
+        _epoch.fetch_add(1);
+        if (_waiting.load() == 0)
+            return;
+        int wake;
+        size_t spinning;
+        {
+            // a waiter between its check and its wait holds the lock.
+            std::lock_guard<std::mutex> lock(_mtx);
+            wake = _waiting;
+            spinning = _spinning.load(std::memory_order_relaxed);
+        }
+        notify(n > spinning ? n - spinning : 0, wake);
+    }
+
+    // at most capacity tasks, 0 for unbounded.
+    void setCapacity(size_t capacity) {
         std::lock_guard<std::mutex> lock(_mtx);
-        return _queue.size();
+        _capacity = capacity ? capacity : SIZE_MAX;
     }
 
+    // make room by taking out the oldest task of the lowest non-empty
+    // priority level.
+    bool dropOldest(Task& t) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_size.load(std::memory_order_relaxed) == 0)
+            return false;
+        int level = highestBit(_nonEmpty);
+        std::deque<Entry>& q = _levels[level];
+        t = std::move(q.front().task);
+        q.pop_front();
+        if (q.empty())
+            _nonEmpty &= ~(1u << level);
+        addSize(-1);
+        return true;
+    }
+
+    // wait until there is room, done or deadline; false unless there is
+    // room.
+    bool waitNotFull(Clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        auto room = [this] {
+            return _size.load(std::memory_order_relaxed) < _capacity || _done;
+        };
+        ++_blocked;
+        if (deadline == Clock::time_point::max())
+            _notFull.wait(lock, room);
+        else
+            _notFull.wait_until(lock, deadline, room);
+        --_blocked;
+        return !_done && _size.load(std::memory_order_relaxed) < _capacity;
+    }
+
+    // how many workers may spin at once, 0 parks at once.
+    void setSpinners(int n) {
+        _maxSpinners.store(n < 0 ? 0 : n, std::memory_order_relaxed);
+    }
+
+    // a task gains one level per interval waited, zero turns aging off.
+    void setAging(std::chrono::microseconds interval) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _aging = interval;
+    }
+
+    // lock-free, may be stale by the time it returns.
+    bool empty()const {
+        return _size.load(std::memory_order_relaxed) == 0;
+    }
+
+    int size() const {
+        return (int)_size.load(std::memory_order_relaxed);
+    }
+
+    // the tasks are destroyed after the lock is released: a task dropped
+    // unrun may push again from its destructor.
     void clean() {
+        std::deque<Entry> dropped[kPriorityLevels];
         std::lock_guard<std::mutex> lock(_mtx);
-        for (int i = 0; i < _queue.size(); ++i)
-            _queue.pop_front();
+        for (int i = 0; i < kPriorityLevels; ++i) {
+            dropped[i].swap(_levels[i]);
+        }
+        _nonEmpty = 0;
+        _size.store(0, std::memory_order_relaxed);
+        if (_blocked)
+            _notFull.notify_all();
     }
 
     void done() {
-        _done = true;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _done = true;
+        }
         _ready.notify_all();
+        _notFull.notify_all();
     }
 private:
-    // change queue to deque.
-    std::deque<Task> _queue;
+    struct Entry {
+        Entry(Task&& t, Clock::time_point when) : task(std::move(t)), enqueued(when) {}
+        Task task;
+        Clock::time_point enqueued;
+    };
+
+    static const uint32_t kMinSpin = 16;
+    static const uint32_t kMaxSpin = 2048;
+    static const int kYieldCount = 4;
+
+    // _size is only written under _mtx, the atomic lets spinners and
+    // empty() read it without the lock.
+    void addSize(ptrdiff_t n) {
+        _size.store(_size.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // queued tasks no spinner is going to take, under _mtx. A spinner
+    // counted here takes the lock and looks at the queue before it can
+    // park, so it will find one of them.
+    size_t uncovered() const {
+        size_t size = _size.load(std::memory_order_relaxed);
+        size_t spinning = _spinning.load(std::memory_order_relaxed);
+        return size > spinning ? size - spinning : 0;
+    }
+
+    // busy-wait a while for a task, done or an epoch change before the
+    // caller locks and parks. Skipped when enough workers spin already.
+    void spin(unsigned seen) {
+        size_t spinning = _spinning.load(std::memory_order_relaxed);
+        do {
+            if (spinning >= _maxSpinners.load(std::memory_order_relaxed))
+                return;
+        } while (!_spinning.compare_exchange_weak(spinning, spinning + 1));
+        auto ready = [&] {
+            return _size.load(std::memory_order_acquire) != 0 || _done.load(std::memory_order_relaxed)
+                || _epoch.load(std::memory_order_relaxed) != seen;
+        };
+        const uint32_t budget = _spinBudget.load(std::memory_order_relaxed);
+        uint32_t spun = 0;
+        bool found = false;
+        for (; spun < budget && !found; ++spun) {
+            cpuRelax();
+            found = ready();
+        }
+        for (int i = 0; i < kYieldCount && !found; ++i) {
+            std::this_thread::yield();
+            found = ready();
+        }
+        _spinning.fetch_sub(1);
+        // a task that came late (or only while yielding) asks for a longer
+        // budget, a miss for a shorter one.
+        uint32_t next;
+        if (found)
+            next = (budget * 3 + 2 * spun) / 4;
+        else
+            next = budget / 2;
+        next = next < kMinSpin ? kMinSpin : (next > kMaxSpin ? kMaxSpin : next);
+        _spinBudget.store(next, std::memory_order_relaxed);
+    }
+
+    static int clampLevel(int level) {
+        return level < 0 ? 0 : (level >= kPriorityLevels ? kPriorityLevels - 1 : level);
+    }
+
+    // enqueue time, only needed (and paid for) when aging is on.
+    Clock::time_point stamp() const {
+        return _aging.count() ? Clock::now() : Clock::time_point();
+    }
+
+    // level to serve next, _size must not be 0.
+    int pickLevel() const {
+        int top = lowestBit(_nonEmpty);
+        if (!_aging.count())
+            return top;
+        Clock::time_point now = Clock::now();
+        int pick = top;
+        long long best = top - (now - _levels[top].front().enqueued) / _aging;
+        Clock::time_point bestTime = _levels[top].front().enqueued;
+        // effective level of each lower level's head, the older task wins
+        // a tie.
+        uint32_t rest = _nonEmpty & ~((2u << top) - 1);
+        while (rest) {
+            int level = lowestBit(rest);
+            rest &= rest - 1;
+            const Entry& head = _levels[level].front();
+            long long effective = level - (now - head.enqueued) / _aging;
+            if (effective < best || (effective == best && head.enqueued < bestTime)) {
+                pick = level;
+                best = effective;
+                bestTime = head.enqueued;
+            }
+        }
+        return pick;
+    }
+
+    void pop(Task& t) {
+        int level = pickLevel();
+        std::deque<Entry>& q = _levels[level];
+        t = std::move(q.front().task);
+        q.pop_front();
+        if (q.empty())
+            _nonEmpty &= ~(1u << level);
+        addSize(-1);
+        if (_blocked)
+            _notFull.notify_one();
+    }
+
+    // wake min(n, waiting) workers, with a single call when that is all.
+    void notify(size_t n, int waiting) {
+        if (n == 0 || waiting == 0)
+            return;
+        if (n >= (size_t)waiting) {
+            _ready.notify_all();
+            return;
+        }
+        while (n--) {
+            _ready.notify_one();
+        }
+    }
+private:
+    // one FIFO per priority level.
+    std::deque<Entry> _levels[kPriorityLevels];
+    // bit i set when _levels[i] is not empty.
+    uint32_t _nonEmpty = 0;
+    std::atomic<size_t> _size{0};
+    std::chrono::microseconds _aging{0};
     mutable std::mutex _mtx;
     std::condition_variable _ready;
     std::atomic_bool _done;
+    std::atomic<unsigned> _epoch{0};
+    // workers blocked in getTask(), only changed under _mtx; atomic so
+    // wake() can skip the lock when it is zero.
+    std::atomic<int> _waiting{0};
+    size_t _capacity = SIZE_MAX;
+    std::condition_variable _notFull;
+    // producers in waitNotFull(), guarded by _mtx.
+    int _blocked = 0;
+    std::atomic<size_t> _spinning{0};
+    std::atomic<size_t> _maxSpinners{1};
+    // pause iterations a spinner tries, shared by all workers.
+    std::atomic<uint32_t> _spinBudget{128};
+};
+
+
+// Per-worker deque for work-stealing mode.
+// The owner pushes and pops at the front (LIFO, cache-hot), thieves take
+// from the back (oldest task). Each deque has its own lock, so workers
+// only contend when they actually steal from each other.
+template<typename Task>
+class WorkStealingQueue {
+public:
+    void push(Task&& t) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _queue.push_front(std::move(t));
+    }
+
+    template<typename It>
+    size_t push_batch(It first, It last) {
+        size_t n = 0;
+        std::lock_guard<std::mutex> lock(_mtx);
+        for (; first != last; ++first, ++n) {
+            _queue.emplace_front(std::move(*first));
+        }
+        return n;
+    }
+
+    bool tryPop(Task& t) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_queue.empty())
+            return false;
+        t = std::move(_queue.front());
+        _queue.pop_front();
+        return true;
+    }
+
+    bool trySteal(Task& t) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_queue.empty())
+            return false;
+        t = std::move(_queue.back());
+        _queue.pop_back();
+        return true;
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _queue.empty();
+    }
+
+    int size() const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _queue.size();
+    }
+
+    // as ThreadSafeQueue::clean(), tasks die outside the lock.
+    void clean() {
+        std::deque<Task> dropped;
+        std::lock_guard<std::mutex> lock(_mtx);
+        dropped.swap(_queue);
+    }
+private:
+    std::deque<Task> _queue;
+    mutable std::mutex _mtx;
 };
 
 
-class ThreadPool {
+enum class ScheduleMode {
+    // all workers share one ThreadSafeQueue.
+    Shared,
+    // one deque per worker, idle workers steal from the others.
+    WorkStealing
+};
+
+enum class ScaleReason {
+    // more than growQueueSize tasks waiting and no idle worker.
+    QueueSize,
+    // a task waited longer than growWait before it started.
+    QueueWait,
+    // a worker above minThreads stayed idle for keepAlive.
+    IdleTimeout
+};
+
+struct ScaleEvent {
+    ScaleReason reason;
+    // worker count after the change.
+    int threads;
+};
+
+enum class Placement {
+    // workers float, one shared queue.
+    None,
+    // worker i pinned to cpus[i % cpus.size()].
+    Cpu,
+    // workers dealt round-robin over NUMA nodes, pinned to their node.
+    SpreadNodes,
+    // a node is filled (one worker per CPU) before the next one is used.
+    PackNodes
+};
+
+// what submit does when the shared queue is full.
+enum class Overflow {
+    // wait for room, up to PoolOptions::blockTimeout.
+    Block,
+    // drop the new task.
+    Reject,
+    // run the new task on the submitting thread.
+    CallerRuns,
+    // drop the oldest queued task (of the lowest priority level) instead.
+    DropOldest
+};
+
+enum class SubmitStatus {
+    Queued,
+    // full under Overflow::Reject, or the pool is shutting down.
+    Rejected,
+    // still full after blockTimeout.
+    TimedOut,
+    // run by the submitting thread.
+    RanInCaller
+};
+
+struct PoolOptions {
+    // the pool starts minThreads workers and may grow up to maxThreads.
+    int minThreads = 1;
+    int maxThreads = 1;
+    ScheduleMode mode = ScheduleMode::Shared;
+    // grow when more tasks than this are waiting and no worker is idle,
+    // 0 turns it off.
+    int growQueueSize = 0;
+    // grow when a task waited longer than this to start, 0 turns it off.
+    std::chrono::microseconds growWait{0};
+    // workers above minThreads retire after being idle this long.
+    std::chrono::milliseconds keepAlive{60000};
+    // called on the thread that grew or shrank the pool.
+    std::function<void(const ScaleEvent&)> onScale;
+    // with any placement but None the pool keeps one queue per NUMA node
+    // in use; tasks go to the submitting thread's node and workers look
+    // there first. On a single-node machine this is one queue as usual.
+    Placement placement = Placement::None;
+    // CPUs the workers may use, empty for every CPU of the process.
+    std::vector<int> cpus;
+    // time tasks for snapshot(): queue wait and run time histograms, busy
+    // and idle time. Costs a clock read at submit and two per task; the
+    // task, steal and wakeup counters are kept regardless.
+    bool stats = false;
+    // idle workers allowed to spin for new work before parking, -1 for
+    // one per four CPUs (none on a single CPU, where spinning only delays
+    // the submitter).
+    int maxSpinners = -1;
+    // tasks each shared queue may hold, 0 for unbounded (RingQueue keeps
+    // its own capacity). Deques of work-stealing workers are not bounded.
+    size_t capacity = 0;
+    Overflow overflow = Overflow::Block;
+    std::chrono::milliseconds blockTimeout = std::chrono::milliseconds::max();
+};
+
+
+// Queue is the shared task queue, ThreadSafeQueue or RingQueue, or any
+// type with the same interface: push(t, level)/push_back/push_front/
+// push_batch (return false or a short count when full), getTask(t),
+// getTask(t, seen, deadline), tryPop, epoch, wakeOne, wake, setAging,
+// setSpinners, empty, size, clean and done.
+template<template<typename> class Queue = ThreadSafeQueue>
+class BasicThreadPool : public Executor {
 public:
-    ThreadPool(const int threadNum) : _done(false) {
-        for (int i = 0; i < threadNum; ++i) {
-            _threads.emplace_back(&ThreadPool::workerThread, this);
+    typedef multi_thread::Task Task;
+    typedef std::chrono::steady_clock Clock;
+
+    BasicThreadPool(const int threadNum, ScheduleMode mode = ScheduleMode::Shared) 
+        : BasicThreadPool(fixedOptions(threadNum, mode)) {
+    }
+
+    // Elastic when minThreads < maxThreads: scaling is decided on the
+    // submit and worker paths (a few atomic reads), there is no monitor
+    // thread.
+    explicit BasicThreadPool(const PoolOptions& options)
+        : _done(false), _mode(options.mode), _options(options), _topology(CpuTopology::Instance()) {
+        if (_options.minThreads < 0)
+            _options.minThreads = 0;
+        if (_options.maxThreads < _options.minThreads)
+            _options.maxThreads = _options.minThreads;
+        if (_options.maxThreads < 1)
+            _options.maxThreads = 1;
+        _elastic = _options.minThreads < _options.maxThreads;
+        _stamp = (_elastic && _options.growWait.count() > 0) || _options.stats;
+        if (!_options.cpus.empty()) {
+            CpuTopology restricted = _topology.restrictTo(_options.cpus);
+            // none of cpus is ours: place on every CPU rather than on none.
+            if (restricted.nodeCount() > 0)
+                _topology = restricted;
+        }
+        int nodes = _options.placement == Placement::None ? 1 : _topology.nodeCount();
+        int spinners = _options.maxSpinners;
+        if (spinners < 0) {
+            int cpus = (int)std::thread::hardware_concurrency();
+            spinners = cpus > 1 ? (cpus + 3) / 4 : 0;
+        }
+        for (int i = 0; i < (nodes > 0 ? nodes : 1); ++i) {
+            _nodes.emplace_back(new NodeState);
+            _nodes.back()->queue.setSpinners(spinners);
+            _nodes.back()->queue.setCapacity(_options.capacity);
         }
+        _workers.reset(new Worker[_options.maxThreads]);
+        // the extra slot is shared by threads outside the pool.
+        _counters.reset(new detail::WorkerCounters[_options.maxThreads + 1]);
+        _counters[_options.maxThreads].setShared(true);
+        if (_mode == ScheduleMode::WorkStealing) {
+            for (int i = 0; i < _options.maxThreads; ++i) {
+                _localQueues.emplace_back(new WorkStealingQueue<Task>);
+            }
+        }
+        std::lock_guard<std::mutex> lock(_workerMtx);
+        for (int i = 0; i < _options.minThreads; ++i) {
+            startWorker(i);
+        }
+        // an elastic pool with no resident worker still needs one to run
+        // the first task, it is started on demand.
     }
-    ~ThreadPool() {
+    ~BasicThreadPool() {
         _done.store(true);
-        _queue.done();
-        for (auto& thread : _threads) {
-            if (thread.joinable())
-                thread.join();
+        for (auto& node : _nodes) {
+            node->queue.done();
         }
+        std::lock_guard<std::mutex> lock(_workerMtx);
+        for (int i = 0; i < _options.maxThreads; ++i) {
+            if (_workers[i].thread.joinable())
+                _workers[i].thread.join();
+        }
+        // tasks never run, their futures get a broken promise.
+        cleanTask();
     }
 
-    // push a Task into queue's back or front according priority. 
-    void submit(const std::function<void(void)>& t, bool priority = false) {
-        if (priority)
-            _queue.push_front(t);
+    // push a Task into queue, ahead of normal ones when priority is set.
+    // In work-stealing mode a task submitted from one of this pool's
+    // workers goes to that worker's own deque (priority is ignored there,
+    // the owner always pops the newest task first).
+    // A full queue is handled by PoolOptions::overflow; a worker of this
+    // pool runs the task itself instead of blocking (waiting there could
+    // deadlock the pool).
+    // The callable is moved, never copied, into the queue.
+    template<typename F>
+    SubmitStatus submit(F&& f, bool priority = false) {
+        return push(Task(std::forward<F>(f)), priority ? kPriorityHighest : kPriorityNormal);
+    }
+
+    // push a Task at one of the kPriorityLevels levels, a level out of
+    // range is clamped to the nearest one. Levels only order tasks in the
+    // shared queue: in work-stealing mode tasks submitted from a worker
+    // go to its deque as above, and RingQueue has a single level.
+    template<typename F>
+    SubmitStatus submit(Priority level, F&& f) {
+        return push(Task(std::forward<F>(f)), level);
+    }
+
+    // let waiting tasks gain one priority level per interval, so lower
+    // levels are not starved. Off (zero) by default.
+    void setAging(std::chrono::microseconds interval) {
+        for (auto& node : _nodes) {
+            node->queue.setAging(interval);
+        }
+    }
+
+    // submit f(args...), arguments are stored with the task and moved into
+    // the call. A single bool after the callable is always taken as the
+    // priority flag above.
+    template<typename F, typename Arg, typename... Args>
+    auto submit(F&& f, Arg&& arg, Args&&... args)
+        -> typename std::enable_if<
+            sizeof...(Args) != 0 || !std::is_same<typename std::decay<Arg>::type, bool>::value,
+            decltype(std::forward<F>(f)(std::forward<Arg>(arg), std::forward<Args>(args)...), SubmitStatus())
+        >::type {
+        return push(Task(bindCall(std::forward<F>(f), std::forward<Arg>(arg), std::forward<Args>(args)...)), kPriorityNormal);
+    }
+
+    // run f(args...) on the pool, the returned Future holds its result
+    // or exception. A task refused by the overflow policy fails the
+    // future with a broken promise.
+    template<typename F, typename... Args>
+    auto async(F&& f, Args&&... args)
+        -> Future<decltype(bindCall(std::forward<F>(f), std::forward<Args>(args)...)())> {
+        auto call = bindCall(std::forward<F>(f), std::forward<Args>(args)...);
+        typedef decltype(call()) R;
+        Promise<R> promise(this);
+        Future<R> future = promise.getFuture();
+        auto work = [call = std::move(call), promise = std::move(promise)]() mutable {
+            detail::Fulfill<R>::run(promise, call);
+        };
+        // only the callable itself may keep the task off the inline buffer.
+        static_assert(std::is_nothrow_move_constructible<decltype(work)>::value
+            || !std::is_nothrow_move_constructible<decltype(call)>::value, "an async task must move as cheaply as f");
+        push(Task(std::move(work)), kPriorityNormal);
+        return future;
+    }
+
+    // run f once after delay. Timers are kept in a hierarchical timing
+    // wheel (1ms ticks) and expired by idle workers while they wait for
+    // tasks, there is no timer thread; when every worker is busy a timer
+    // runs once one of them finishes its task.
+    template<typename Rep, typename Period, typename F>
+    TimerId submitAfter(const std::chrono::duration<Rep, Period>& delay, F&& f) {
+        return addTimer(Clock::now() + delay, Task(std::forward<F>(f)), Clock::duration::zero());
+    }
+
+    // run f once at when.
+    template<typename F>
+    TimerId submitAt(Clock::time_point when, F&& f) {
+        return addTimer(when, Task(std::forward<F>(f)), Clock::duration::zero());
+    }
+
+    // run f every period, first after one period, until cancelTimer().
+    // A run that comes due while the previous one is still going is
+    // skipped, f never runs on two workers at once.
+    template<typename Rep, typename Period, typename F>
+    TimerId submitEvery(const std::chrono::duration<Rep, Period>& period, F&& f) {
+        return addTimer(Clock::now() + period, Task(std::forward<F>(f)),
+            std::chrono::duration_cast<Clock::duration>(period));
+    }
+
+    // return false if the timer has already fired or been cancelled.
+    bool cancelTimer(TimerId id) {
+        std::lock_guard<std::mutex> lock(_timerMtx);
+        return _timers.cancel(id);
+    }
+
+    // submit every callable in [first, last) (they are moved from). The
+    // shared queue is locked once and each idle worker woken at most once.
+    template<typename It>
+    void submitBatch(It first, It last) {
+        if (_done)
+            return;
+        if (_stamp) {
+            // tasks need their queue time set, go through a small buffer.
+            Task buffer[32];
+            while (first != last) {
+                int64_t now = Clock::now().time_since_epoch().count();
+                size_t n = 0;
+                for (; first != last && n < 32; ++first, ++n) {
+                    buffer[n] = Task(std::move(*first));
+                    buffer[n].setQueuedAt(now);
+                }
+                pushBatch(buffer, buffer + n);
+            }
+            return;
+        }
+        pushBatch(first, last);
+    }
+
+    // call fn(i) for every i in [first, last) on the pool and wait for all.
+    // The range is split lazily: a task keeps running grain-sized chunks of
+    // its range and only hands the right half over to the pool while the
+    // pool looks hungry, so a big loop costs a few tasks per worker instead
+    // of one per element. The calling thread takes part; the first
+    // exception thrown by fn is rethrown here.
+    template<typename Index, typename F>
+    void parallel_for(Index first, Index last, F&& fn, Index grain = 1) {
+        if (!(first < last))
+            return;
+        if (grain < 1)
+            grain = 1;
+        ForContext<Index, typename std::remove_reference<F>::type> ctx(fn, last - first);
+        runRange(&ctx, first, last, grain);
+        while (ctx.remaining.load(std::memory_order_acquire) != 0) {
+            if (!runPendingTask())
+                std::this_thread::yield();
+        }
+        if (ctx.error)
+            std::rethrow_exception(ctx.error);
+    }
+
+    // co_await pool.schedule() continues the coroutine on a worker, see
+    // coroutine.h for coroutine tasks.
+    ScheduleAwaiter schedule() {
+        return ScheduleAwaiter(*this);
+    }
+
+    // Executor
+    void execute(Task&& t) override {
+        push(std::move(t), kPriorityNormal);
+    }
+
+    // run one queued task on the calling thread, used by waits that help.
+    bool runPendingTask() override {
+        Task t;
+        LocalState& local = localState();
+        bool found;
+        if (local.pool == this)
+            found = findTask(local.index, local.node, t);
         else
-            _queue.push_back(t);
+            found = popShared(callerNode(), t) || steal(0, t);
+        if (!found)
+            return false;
+        runTask(t);
+        return true;
+    }
+
+    // merge the per-worker counters; workers keep running, so the totals
+    // may be a few tasks behind.
+    PoolStats snapshot() const {
+        PoolStats stats;
+        stats.workers.resize(_options.maxThreads + 1);
+        for (int i = 0; i <= _options.maxThreads; ++i) {
+            _counters[i].collect(stats.workers[i], stats.queueWait, stats.execTime);
+            stats.total += stats.workers[i];
+        }
+        stats.blocked = _overflow.blocked.load(std::memory_order_relaxed);
+        stats.timedOut = _overflow.timedOut.load(std::memory_order_relaxed);
+        stats.rejected = _overflow.rejected.load(std::memory_order_relaxed);
+        stats.callerRuns = _overflow.callerRuns.load(std::memory_order_relaxed);
+        stats.dropped = _overflow.dropped.load(std::memory_order_relaxed);
+        return stats;
     }
 
     bool isEmpty()const {
-        return _queue.empty();
+        for (auto& node : _nodes) {
+            if (!node->queue.empty())
+                return false;
+        }
+        for (auto& q : _localQueues) {
+            if (!q->empty())
+                return false;
+        }
+        return true;
     }
     int taskSize()const {
-        return _queue.size();
+        int size = 0;
+        for (auto& node : _nodes) {
+            size += node->queue.size();
+        }
+        for (auto& q : _localQueues) {
+            size += q->size();
+        }
+        return size;
     }
     void cleanTask() {
-        _queue.clean();
+        if (_elastic)
+            _pending.fetch_sub(taskSize(), std::memory_order_relaxed);
+        for (auto& node : _nodes) {
+            node->queue.clean();
+        }
+        for (auto& q : _localQueues) {
+            q->clean();
+        }
+    }
+    ScheduleMode mode() const {
+        return _mode;
+    }
+    // current number of workers.
+    int threadCount() const {
+        return _threadCount.load();
     }
 private:
-    void workerThread() {
-        while (true) {
-            std::function<void(void)> t;
-            //  
-            _queue.getTask(t);
-            if (_done)
-                break;
-            if (t)
-                t();
+    // which pool (if any) the current thread works for.
+    struct LocalState {
+        BasicThreadPool* pool = nullptr;
+        int index = 0;
+        int node = 0;
+    };
+    static LocalState& localState() {
+        static thread_local LocalState state;
+        return state;
+    }
+
+    template<typename Index, typename F>
+    struct ForContext {
+        ForContext(F& f, Index count) : fn(f), remaining(count), failed(false) {}
+        F& fn;
+        // elements not yet done or skipped.
+        std::atomic<Index> remaining;
+        std::atomic_bool failed;
+        std::mutex mtx;
+        std::exception_ptr error;
+    };
+
+    // the right half a parallel_for task hands over. One dropped unrun
+    // (DropOldest, clean()) still runs its range where it is destroyed,
+    // or parallel_for would wait for it forever.
+    template<typename Index, typename Ctx>
+    class RangeTask {
+    public:
+        RangeTask(BasicThreadPool* pool, Ctx* ctx, Index begin, Index end, Index grain)
+            : _pool(pool), _ctx(ctx), _begin(begin), _end(end), _grain(grain) {}
+        RangeTask(RangeTask&& that) noexcept
+            : _pool(that._pool), _ctx(that._ctx), _begin(that._begin), _end(that._end), _grain(that._grain) {
+            that._ctx = nullptr;
+        }
+        RangeTask(const RangeTask&) = delete;
+        ~RangeTask() {
+            (*this)();
+        }
+        void operator()() {
+            Ctx* ctx = _ctx;
+            _ctx = nullptr;
+            if (ctx)
+                _pool->runRange(ctx, _begin, _end, _grain);
+        }
+    private:
+        BasicThreadPool* _pool;
+        Ctx* _ctx;
+        Index _begin;
+        Index _end;
+        Index _grain;
+    };
+
+    // whether a parallel_for task should split: nobody has picked up
+    // the work we already handed out.
+    bool hungry() {
+        LocalState& local = localState();
+        if (_mode == ScheduleMode::WorkStealing && local.pool == this)
+            return _localQueues[local.index]->empty();
+        return _nodes[local.pool == this ? local.node : callerNode()]->queue.empty();
+    }
+
+    template<typename Index, typename Ctx>
+    void runRange(Ctx* ctx, Index begin, Index end, Index grain) {
+        while (begin < end) {
+            while (end - begin > grain && hungry()) {
+                Index mid = begin + (end - begin) / 2;
+                Task split(RangeTask<Index, Ctx>(this, ctx, mid, end, grain));
+                // push() leaves a refused task untouched: run it here.
+                SubmitStatus status = push(std::move(split), kPriorityNormal);
+                if (status == SubmitStatus::Rejected || status == SubmitStatus::TimedOut)
+                    split();
+                end = mid;
+            }
+            Index stop = end - begin > grain ? begin + grain : end;
+            if (!ctx->failed.load(std::memory_order_relaxed)) {
+                try {
+                    for (Index i = begin; i < stop; ++i) {
+                        ctx->fn(i);
+                    }
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(ctx->mtx);
+                    if (!ctx->failed.exchange(true))
+                        ctx->error = std::current_exception();
+                }
+            }
+            // skip the rest once failed, still counting it as done.
+            if (ctx->failed.load(std::memory_order_relaxed))
+                stop = end;
+            Index count = stop - begin;
+            begin = stop;
+            // ctx may be gone once the last element is counted.
+            ctx->remaining.fetch_sub(count, std::memory_order_acq_rel);
+        }
+    }
+
+    static PoolOptions fixedOptions(int threadNum, ScheduleMode mode) {
+        PoolOptions options;
+        options.minThreads = threadNum;
+        options.maxThreads = threadNum;
+        options.mode = mode;
+        return options;
+    }
+
+    // _workerMtx held.
+    void startWorker(int index) {
+        Worker& worker = _workers[index];
+        // a retired worker in this slot may still be on its way out.
+        if (worker.thread.joinable())
+            worker.thread.join();
+        worker.running.store(true);
+        worker.cpus.clear();
+        worker.node = place(index, worker.cpus);
+        ++_threadCount;
+        if (index >= _slotCount.load())
+            _slotCount.store(index + 1);
+        worker.thread = std::thread(&BasicThreadPool::workerThread, this, index);
+    }
+
+    // node of worker slot index and the CPUs it is pinned to (none for
+    // Placement::None).
+    int place(int index, std::vector<int>& cpus) {
+        const int nodes = _topology.nodeCount();
+        if (nodes == 0)
+            return 0;
+        switch (_options.placement) {
+        case Placement::Cpu: {
+            std::vector<int> all;
+            for (int n = 0; n < nodes; ++n) {
+                all.insert(all.end(), _topology.cpusOf(n).begin(), _topology.cpusOf(n).end());
+            }
+            int cpu = all[index % all.size()];
+            cpus.push_back(cpu);
+            return _topology.nodeOf(cpu);
+        }
+        case Placement::SpreadNodes: {
+            int node = index % nodes;
+            cpus = _topology.cpusOf(node);
+            return node;
+        }
+        case Placement::PackNodes: {
+            int total = 0;
+            for (int n = 0; n < nodes; ++n) {
+                total += _topology.cpusOf(n).size();
+            }
+            int slot = index % total;
+            int node = 0;
+            while (slot >= (int)_topology.cpusOf(node).size()) {
+                slot -= _topology.cpusOf(node).size();
+                ++node;
+            }
+            cpus = _topology.cpusOf(node);
+            return node;
+        }
+        default:
+            return 0;
+        }
+    }
+
+    // node queue for a thread that is not one of our workers: the node
+    // of the CPU it runs on right now.
+    int callerNode() const {
+        if (_nodes.size() == 1)
+            return 0;
+        int node = _topology.nodeOf(currentCpu());
+        return node < (int)_nodes.size() ? node : 0;
+    }
+
+    // start one more worker if below maxThreads.
+    void grow(ScaleReason reason) {
+        std::unique_lock<std::mutex> lock(_workerMtx, std::try_to_lock);
+        if (!lock.owns_lock() || _done || _threadCount.load() >= _options.maxThreads)
+            return;
+        // claimed against a retiring worker taking its slot back, see
+        // retire().
+        bool started = false;
+        for (int i = 0; i < _options.maxThreads && !started; ++i) {
+            bool running = false;
+            if (_workers[i].running.compare_exchange_strong(running, true)) {
+                startWorker(i);
+                started = true;
+            }
         }
+        int threads = _threadCount.load();
+        lock.unlock();
+        if (started)
+            report(reason, threads);
+    }
+
+    // an idle worker leaves if the pool is above minThreads. Its slot is
+    // free for grow() before the last look at the queues, so a push that
+    // finds no worker meanwhile can start one in it.
+    bool retire(int index) {
+        int n = _threadCount.load();
+        while (n > _options.minThreads) {
+            if (_threadCount.compare_exchange_weak(n, n - 1)) {
+                // a task pushed while we were leaving may have seen us
+                // still counted, stay for it.
+                if (!isEmpty()) {
+                    ++_threadCount;
+                    return false;
+                }
+                // reported while the slot is ours: onScale may submit.
+                report(ScaleReason::IdleTimeout, n - 1);
+                _workers[index].running.store(false);
+                // against the fence in checkBacklog().
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                // come back for a task pushed since, unless grow() took
+                // the slot for it.
+                if (!isEmpty() && !_workers[index].running.exchange(true)) {
+                    report(ScaleReason::QueueSize, ++_threadCount);
+                    return false;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void report(ScaleReason reason, int threads) {
+        if (_options.onScale)
+            _options.onScale(ScaleEvent{ reason, threads });
+    }
+
+    // grow on the submit path: a backlog and nobody idle to take it.
+    void checkBacklog() {
+        if (_options.growQueueSize > 0
+            && _idle.load(std::memory_order_relaxed) == 0
+            && _pending.load(std::memory_order_relaxed) > _options.growQueueSize
+            && _threadCount.load(std::memory_order_relaxed) < _options.maxThreads)
+            grow(ScaleReason::QueueSize);
+        // an elastic pool may be down to zero workers. Without resident
+        // workers order the push before the count, against retire().
+        else {
+            if (_options.minThreads == 0)
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_threadCount.load(std::memory_order_relaxed) == 0)
+                grow(ScaleReason::QueueSize);
+        }
+    }
+
+    void runTask(Task& t) {
+        detail::WorkerCounters& counters = myCounters();
+        counters.add(detail::WorkerCounters::kExecuted);
+        if (!_stamp) {
+            if (_elastic)
+                _pending.fetch_sub(1, std::memory_order_relaxed);
+            t();
+            return;
+        }
+        Clock::time_point start = Clock::now();
+        Clock::duration waited = Clock::duration::zero();
+        if (t.queuedAt())
+            waited = start.time_since_epoch() - Clock::duration(t.queuedAt());
+        if (_elastic) {
+            _pending.fetch_sub(1, std::memory_order_relaxed);
+            if (_options.growWait.count() > 0 && waited > _options.growWait
+                && _idle.load(std::memory_order_relaxed) == 0)
+                grow(ScaleReason::QueueWait);
+        }
+        if (!_options.stats) {
+            t();
+            return;
+        }
+        counters.recordWait(toNs(waited));
+        t();
+        counters.recordExec(toNs(Clock::now() - start));
+    }
+
+    // counters of the calling thread's slot.
+    detail::WorkerCounters& myCounters() {
+        LocalState& local = localState();
+        return _counters[local.pool == this ? local.index : _options.maxThreads];
+    }
+
+    static uint64_t toNs(Clock::duration d) {
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        return ns > 0 ? (uint64_t)ns : 0;
+    }
+
+    void workerThread(int index) {
+        const int node = _workers[index].node;
+        localState().pool = this;
+        localState().index = index;
+        localState().node = node;
+        if (!_workers[index].cpus.empty())
+            setThreadAffinity(_workers[index].cpus);
+        // with a single queue and no deques the worker simply blocks in
+        // getTask(), there is nothing to look through first.
+        const bool search = _mode == ScheduleMode::WorkStealing || _nodes.size() > 1;
+        while (!_done) {
+            Task t;
+            // read epoch before looking around, so a push we miss
+            // makes getTask() below return at once.
+            unsigned seen = _nodes[node]->queue.epoch();
+            bool found = search && findTask(index, node, t);
+            if (!found) {
+                Clock::time_point parked;
+                if (_options.stats)
+                    parked = Clock::now();
+                bool keep = idleWait(t, node, seen);
+                _counters[index].add(detail::WorkerCounters::kWakeups);
+                if (_options.stats)
+                    _counters[index].add(detail::WorkerCounters::kIdleNs, toNs(Clock::now() - parked));
+                // the slot is not ours any more.
+                if (!keep && retire(index))
+                    return;
+                if (_done)
+                    break;
+                if (!t)
+                    continue;
+            }
+            runTask(t);
+            expireTimers();
+        }
+        _workers[index].running.store(false);
+    }
+
+    // own deque, own node's queue, the other nodes' queues, then steal.
+    bool findTask(int index, int node, Task& t) {
+        if (_mode == ScheduleMode::WorkStealing && _localQueues[index]->tryPop(t))
+            return true;
+        if (popShared(node, t))
+            return true;
+        if (!steal(index + 1, t))
+            return false;
+        _counters[index].add(detail::WorkerCounters::kSteals);
+        return true;
+    }
+
+    // try node's queue first, then the others.
+    bool popShared(int node, Task& t) {
+        const int n = _nodes.size();
+        for (int i = 0; i < n; ++i) {
+            if (_nodes[(node + i) % n]->queue.tryPop(t))
+                return true;
+        }
+        return false;
+    }
+
+    // work became available for node: wake one of its workers, and if
+    // none of them is idle, one idle worker of another node.
+    void wakeNode(int node, size_t n = 1) {
+        _nodes[node]->queue.wake(n);
+        if (_nodes.size() == 1 || _nodes[node]->idle.load(std::memory_order_relaxed) > 0)
+            return;
+        for (auto& other : _nodes) {
+            if (other->idle.load(std::memory_order_relaxed) > 0) {
+                other->queue.wake(n);
+                return;
+            }
+        }
+    }
+
+    // wait in the shared queue. The idle worker that sees the earliest
+    // timer deadline also waits for it and runs the wheel, the others
+    // sleep until work or a wakeOne() shows up, or until keepAlive runs
+    // out for workers above minThreads. Return false on that timeout.
+    bool idleWait(Task& t, int node, unsigned seen) {
+        IdleGuard idle(_idle);
+        IdleGuard nodeIdle(_nodes[node]->idle);
+        Queue<Task>& queue = _nodes[node]->queue;
+        // a push elsewhere only wakes this node if it saw us idle; now
+        // that we count as idle, look once more before sleeping.
+        if (_nodes.size() > 1 && !isEmpty())
+            return true;
+        Clock::time_point next = _timers.nextExpiry();
+        int64_t deadline = next.time_since_epoch().count();
+        int64_t current = _timerDeadline.load();
+        bool drive = next != Clock::time_point::max() && deadline < current
+            && _timerDeadline.compare_exchange_strong(current, deadline);
+        if (!drive) {
+            if (_elastic && _threadCount.load() > _options.minThreads) {
+                Clock::time_point expire = Clock::now() + _options.keepAlive;
+                queue.getTask(t, seen, expire);
+                return t || Clock::now() < expire;
+            }
+            queue.getTask(t, seen);
+            return true;
+        }
+        queue.getTask(t, seen, next);
+        _timerDeadline.compare_exchange_strong(deadline, kNoDeadline);
+        expireTimers();
+        // about to run a task, let another idle worker watch the timers.
+        if (t && _timers.nextExpiry() != Clock::time_point::max())
+            wakeIdle();
+        return true;
+    }
+
+    struct IdleGuard {
+        explicit IdleGuard(std::atomic<int>& n) : count(n) { ++count; }
+        ~IdleGuard() { --count; }
+        std::atomic<int>& count;
+    };
+
+    // run the wheel if a timer is due, handing expired tasks to the pool.
+    void expireTimers() {
+        Clock::time_point next = _timers.nextExpiry();
+        if (next == Clock::time_point::max())
+            return;
+        Clock::time_point now = Clock::now();
+        if (now < next)
+            return;
+        std::unique_lock<std::mutex> lock(_timerMtx, std::try_to_lock);
+        if (!lock.owns_lock())
+            return;
+        static thread_local std::vector<Task> due;
+        _timers.expire(now, due);
+        lock.unlock();
+        submitBatch(due.begin(), due.end());
+        due.clear();
+    }
+
+    // wake some idle worker, preferably on a node that has one.
+    void wakeIdle() {
+        for (auto& node : _nodes) {
+            if (node->idle.load(std::memory_order_relaxed) > 0) {
+                node->queue.wakeOne();
+                return;
+            }
+        }
+        _nodes[0]->queue.wakeOne();
+    }
+
+    TimerId addTimer(Clock::time_point when, Task&& t, Clock::duration period) {
+        if (!t || _done)
+            return 0;
+        TimerId id;
+        bool earlier;
+        {
+            std::lock_guard<std::mutex> lock(_timerMtx);
+            Clock::time_point before = _timers.nextExpiry();
+            id = _timers.add(when, std::move(t), period);
+            earlier = _timers.nextExpiry() < before;
+        }
+        // a sleeping worker has to pick up the new deadline.
+        if (earlier)
+            wakeIdle();
+        if (_elastic && _threadCount.load() == 0)
+            grow(ScaleReason::QueueSize);
+        return id;
+    }
+
+    SubmitStatus push(Task&& t, int level) {
+        // dropped once the pool is shutting down.
+        if (!t || _done)
+            return SubmitStatus::Rejected;
+        if (_elastic)
+            _pending.fetch_add(1, std::memory_order_relaxed);
+        if (_stamp)
+            t.setQueuedAt(Clock::now().time_since_epoch().count());
+        LocalState& local = localState();
+        const bool worker = local.pool == this;
+        const int node = worker ? local.node : callerNode();
+        if (_mode == ScheduleMode::WorkStealing && worker) {
+            _localQueues[local.index]->push(std::move(t));
+            wakeNode(node);
+        }
+        else {
+            Queue<Task>& queue = _nodes[node]->queue;
+            if (!queue.push(std::move(t), level)) {
+                SubmitStatus status = overflow(queue, t, level, worker);
+                if (status != SubmitStatus::Queued)
+                    return status;
+            }
+            // the queue woke one of node's own workers.
+            if (_nodes.size() > 1 && _nodes[node]->idle.load(std::memory_order_relaxed) == 0)
+                wakeNode(node);
+        }
+        if (_elastic)
+            checkBacklog();
+        return SubmitStatus::Queued;
+    }
+
+    // queue was full for t: apply PoolOptions::overflow. Off the fast
+    // path, so the outcome counters may be shared atomics.
+    SubmitStatus overflow(Queue<Task>& queue, Task& t, int level, bool worker) {
+        Overflow policy = _options.overflow;
+        if (worker && policy == Overflow::Block)
+            policy = Overflow::CallerRuns;
+        switch (policy) {
+        case Overflow::Reject:
+            return refuse(_overflow.rejected, SubmitStatus::Rejected);
+        case Overflow::CallerRuns:
+            _overflow.callerRuns.fetch_add(1, std::memory_order_relaxed);
+            runTask(t);
+            return SubmitStatus::RanInCaller;
+        case Overflow::DropOldest:
+            do {
+                Task oldest;
+                if (queue.dropOldest(oldest)) {
+                    _overflow.dropped.fetch_add(1, std::memory_order_relaxed);
+                    if (_elastic)
+                        _pending.fetch_sub(1, std::memory_order_relaxed);
+                }
+                // oldest is destroyed here, outside the queue's lock.
+            } while (!queue.push(std::move(t), level));
+            return SubmitStatus::Queued;
+        default: {
+            _overflow.blocked.fetch_add(1, std::memory_order_relaxed);
+            Clock::time_point deadline = Clock::time_point::max();
+            if (_options.blockTimeout != std::chrono::milliseconds::max())
+                deadline = Clock::now() + _options.blockTimeout;
+            while (!queue.push(std::move(t), level)) {
+                if (!queue.waitNotFull(deadline)) {
+                    if (_done)
+                        return refuse(_overflow.rejected, SubmitStatus::Rejected);
+                    if (Clock::now() >= deadline)
+                        return refuse(_overflow.timedOut, SubmitStatus::TimedOut);
+                }
+            }
+            return SubmitStatus::Queued;
+        }
+        }
+    }
+
+    SubmitStatus refuse(std::atomic<uint64_t>& counter, SubmitStatus status) {
+        counter.fetch_add(1, std::memory_order_relaxed);
+        if (_elastic)
+            _pending.fetch_sub(1, std::memory_order_relaxed);
+        return status;
+    }
+
+    template<typename It>
+    void pushBatch(It first, It last) {
+        LocalState& local = localState();
+        const bool worker = local.pool == this;
+        const int node = worker ? local.node : callerNode();
+        size_t n;
+        if (_mode == ScheduleMode::WorkStealing && worker) {
+            n = _localQueues[local.index]->push_batch(first, last);
+            wakeNode(node, n);
+        }
+        else {
+            n = _nodes[node]->queue.push_batch(first, last);
+            std::advance(first, n);
+            if (_nodes.size() > 1 && _nodes[node]->idle.load(std::memory_order_relaxed) == 0)
+                wakeNode(node, n);
+        }
+        if (_elastic) {
+            _pending.fetch_add(n, std::memory_order_relaxed);
+            checkBacklog();
+        }
+        // a bounded queue may take only part of the batch.
+        for (; first != last; ++first) {
+            push(Task(std::move(*first)), kPriorityNormal);
+        }
+    }
+
+    // steal from the workers' deques starting at start, a worker starts
+    // from its right neighbour so thieves spread over the victims.
+    bool steal(int start, Task& t) {
+        if (_localQueues.empty())
+            return false;
+        const int n = _slotCount.load(std::memory_order_relaxed);
+        for (int i = 0; i < n; ++i) {
+            if (_localQueues[(start + i) % n]->trySteal(t))
+                return true;
+        }
+        return false;
     }
 private:
-    std::vector<std::thread> _threads;
-    ThreadSafeQueue<std::function<void(void)>> _queue;
+    struct Worker {
+        std::thread thread;
+        std::atomic_bool running{false};
+        int node = 0;
+        std::vector<int> cpus;
+    };
+
+    // per NUMA node queue, a single one unless placement asks for more.
+    struct NodeState {
+        Queue<Task> queue;
+        // workers of this node in idleWait().
+        std::atomic<int> idle{0};
+    };
+
+    std::unique_ptr<Worker[]> _workers;
+    std::unique_ptr<detail::WorkerCounters[]> _counters;
+    std::mutex _workerMtx;
+    std::atomic<int> _threadCount{0};
+    // workers slots in use are below this, bounds the steal loop.
+    std::atomic<int> _slotCount{0};
+    std::atomic<int> _idle{0};
+    // tasks queued and not started, only kept by elastic pools.
+    std::atomic<int> _pending{0};
+    struct OverflowCounters {
+        std::atomic<uint64_t> blocked{0};
+        std::atomic<uint64_t> timedOut{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> callerRuns{0};
+        std::atomic<uint64_t> dropped{0};
+    } _overflow;
+    std::vector<std::unique_ptr<NodeState>> _nodes;
+    std::vector<std::unique_ptr<WorkStealingQueue<Task>>> _localQueues;
     std::atomic_bool _done;
+    ScheduleMode _mode;
+    PoolOptions _options;
+    // CPUs by node the workers are placed on.
+    CpuTopology _topology;
+    bool _elastic;
+    // tasks carry their queue time.
+    bool _stamp;
+
+    static const int64_t kNoDeadline = INT64_MAX;
+    TimerWheel _timers;
+    std::mutex _timerMtx;
+    // deadline (Clock ticks) the timer-watching idle worker sleeps until.
+    std::atomic<int64_t> _timerDeadline{kNoDeadline};
 };
 
+typedef BasicThreadPool<> ThreadPool;
+
 }// namespace
\ No newline at end of file
@@ -0,0 +1,350 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "task.h"
+
+namespace multi_thread {
+
+// 0 is never a valid id.
+typedef uint64_t TimerId;
+
+// Hierarchical timing wheel with 1ms ticks.
+// Level 0 has 256 one-tick slots, levels 1-3 have 64 slots each covering
+// 64 times the span of a slot below (about 18.6 hours in total); timers
+// further out wait in the last level and are re-filed as it turns.
+// Timers live in a slab linked through indices, so add and cancel are
+// O(1) and a TimerId stays safe to cancel after the timer has fired.
+// Not thread-safe by itself except nextExpiry(); the owner locks.
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::chrono::milliseconds Tick;
+
+    TimerWheel() : _start(Clock::now()), _next(0), _count(0) {
+        for (auto& level : _slots) {
+            for (auto& head : level) {
+                head = kNil;
+            }
+        }
+        for (auto& bits : _bitmap) {
+            bits = 0;
+        }
+        _nextTick.store(kNever);
+    }
+
+    // run t at when, or every period from when on if period is not zero.
+    TimerId add(Clock::time_point when, Task&& t, Clock::duration period = Clock::duration::zero()) {
+        uint32_t index = allocate();
+        Node& node = _nodes[index];
+        node.expires = toTick(when);
+        node.period = 0;
+        if (period > Clock::duration::zero()) {
+            node.period = std::chrono::duration_cast<Tick>(period).count();
+            if (node.period == 0)
+                node.period = 1;
+            node.repeat = std::make_shared<Periodic>(std::move(t));
+        }
+        else {
+            node.task = std::move(t);
+        }
+        link(index);
+        ++_count;
+        updateNextTick();
+        return ((uint64_t)node.generation << 32) | index;
+    }
+
+    // return false if the timer already fired (one-shot) or was cancelled.
+    bool cancel(TimerId id) {
+        uint32_t index = (uint32_t)id;
+        if (id == 0 || index >= _nodes.size())
+            return false;
+        Node& node = _nodes[index];
+        if (node.generation != (uint32_t)(id >> 32) || !node.linked)
+            return false;
+        unlink(index);
+        release(index);
+        --_count;
+        updateNextTick();
+        return true;
+    }
+
+    // move the tasks of every timer due at now to out (anything with
+    // push_back(Task&&)), periodic timers are filed again. A periodic
+    // timer whose previous run has not finished yet skips this one, so
+    // its callable never runs twice at once.
+    template<typename Out>
+    void expire(Clock::time_point now, Out& out) {
+        uint64_t target = elapsedTicks(now);
+        if (_count == 0) {
+            if (target >= _next)
+                _next = target + 1;
+            return;
+        }
+        while (_next <= target) {
+            uint32_t slot = _next & kRootMask;
+            // level 0 turned, pull the next slot of each upper level down.
+            if (slot == 0 && cascade(1) == 0 && cascade(2) == 0)
+                cascade(3);
+            ++_next;
+            uint32_t index = takeSlot(0, slot);
+            while (index != kNil) {
+                Node& node = _nodes[index];
+                uint32_t next = node.next;
+                node.linked = false;
+                if (node.period) {
+                    if (!node.repeat->running.exchange(true, std::memory_order_acquire))
+                        out.push_back(Task(PeriodicRun(node.repeat)));
+                    node.expires += node.period;
+                    if (node.expires < _next)
+                        node.expires = _next;
+                    link(index);
+                }
+                else {
+                    out.push_back(std::move(node.task));
+                    release(index);
+                    --_count;
+                }
+                index = next;
+            }
+        }
+        updateNextTick();
+    }
+
+    // when expire() has something to do next, Clock::time_point::max()
+    // if no timer is pending. May be early (a level turning over), never
+    // late. Lock-free.
+    Clock::time_point nextExpiry() const {
+        uint64_t tick = _nextTick.load(std::memory_order_acquire);
+        if (tick == kNever)
+            return Clock::time_point::max();
+        return _start + Tick(tick);
+    }
+
+    size_t size() const {
+        return _count;
+    }
+private:
+    static const uint32_t kNil = 0xffffffff;
+    static const uint64_t kNever = ~0ull;
+    static const int kRootBits = 8;
+    static const int kLevelBits = 6;
+    static const int kLevels = 4;
+    static const uint32_t kRootSize = 1u << kRootBits;
+    static const uint32_t kRootMask = kRootSize - 1;
+    static const uint32_t kLevelSize = 1u << kLevelBits;
+    static const uint32_t kLevelMask = kLevelSize - 1;
+    // ticks covered by the whole wheel.
+    static const uint64_t kSpan = 1ull << (kRootBits + (kLevels - 1) * kLevelBits);
+
+    // the callable of a periodic timer, shared by its runs.
+    struct Periodic {
+        explicit Periodic(Task&& t) : task(std::move(t)) {}
+        Task task;
+        // a run is queued or going.
+        std::atomic_bool running{false};
+    };
+
+    // one run of a periodic timer. Clears running when it is done, or
+    // when it is destroyed unrun (pool overflow or shutdown).
+    class PeriodicRun {
+    public:
+        explicit PeriodicRun(const std::shared_ptr<Periodic>& periodic) : _periodic(periodic) {}
+        PeriodicRun(PeriodicRun&& that) noexcept : _periodic(std::move(that._periodic)) {}
+        PeriodicRun(const PeriodicRun&) = delete;
+        ~PeriodicRun() {
+            if (_periodic)
+                _periodic->running.store(false, std::memory_order_release);
+        }
+        void operator()() {
+            // cleared by run's destructor, also if the task throws.
+            PeriodicRun run(std::move(*this));
+            run._periodic->task();
+        }
+    private:
+        std::shared_ptr<Periodic> _periodic;
+    };
+
+    struct Node {
+        uint32_t prev = kNil;
+        uint32_t next = kNil;
+        uint32_t generation = 1;
+        uint8_t level = 0;
+        uint8_t slot = 0;
+        bool linked = false;
+        uint64_t expires = 0;
+        // ticks, 0 for one-shot timers.
+        uint64_t period = 0;
+        Task task;
+        std::shared_ptr<Periodic> repeat;
+    };
+
+    // ticks since _start, rounded up so timers never fire early.
+    uint64_t toTick(Clock::time_point when) const {
+        if (when <= _start)
+            return 0;
+        Clock::duration d = when - _start;
+        Tick t = std::chrono::duration_cast<Tick>(d);
+        if (t < d)
+            t += Tick(1);
+        return t.count();
+    }
+
+    uint64_t elapsedTicks(Clock::time_point now) const {
+        if (now <= _start)
+            return 0;
+        return std::chrono::duration_cast<Tick>(now - _start).count();
+    }
+
+    uint32_t allocate() {
+        if (_free != kNil) {
+            uint32_t index = _free;
+            _free = _nodes[index].next;
+            return index;
+        }
+        _nodes.emplace_back();
+        return (uint32_t)_nodes.size() - 1;
+    }
+
+    void release(uint32_t index) {
+        Node& node = _nodes[index];
+        node.task.reset();
+        node.repeat.reset();
+        ++node.generation;
+        node.next = _free;
+        _free = index;
+    }
+
+    // file a node by how far away it expires, as in the classic kernel
+    // timer wheel.
+    void link(uint32_t index) {
+        Node& node = _nodes[index];
+        uint64_t expires = node.expires;
+        if (expires < _next)
+            expires = _next;
+        uint64_t delta = expires - _next;
+        int level;
+        uint32_t slot;
+        if (delta < kRootSize) {
+            level = 0;
+            slot = expires & kRootMask;
+        }
+        else {
+            if (delta >= kSpan)
+                expires = _next + kSpan - 1;
+            level = 1;
+            while (level < kLevels - 1 && (expires - _next) >= (1ull << (kRootBits + level * kLevelBits)))
+                ++level;
+            slot = (expires >> (kRootBits + (level - 1) * kLevelBits)) & kLevelMask;
+        }
+        node.level = (uint8_t)level;
+        node.slot = (uint8_t)slot;
+        node.prev = kNil;
+        node.next = _slots[level][slot];
+        if (node.next != kNil)
+            _nodes[node.next].prev = index;
+        _slots[level][slot] = index;
+        _bitmap[bitmapWord(level, slot)] |= 1ull << (slot & 63);
+        node.linked = true;
+    }
+
+    void unlink(uint32_t index) {
+        Node& node = _nodes[index];
+        if (node.prev != kNil)
+            _nodes[node.prev].next = node.next;
+        else
+            _slots[node.level][node.slot] = node.next;
+        if (node.next != kNil)
+            _nodes[node.next].prev = node.prev;
+        if (_slots[node.level][node.slot] == kNil)
+            _bitmap[bitmapWord(node.level, node.slot)] &= ~(1ull << (node.slot & 63));
+        node.linked = false;
+    }
+
+    // detach a whole slot, return its first node.
+    uint32_t takeSlot(int level, uint32_t slot) {
+        uint32_t head = _slots[level][slot];
+        _slots[level][slot] = kNil;
+        _bitmap[bitmapWord(level, slot)] &= ~(1ull << (slot & 63));
+        return head;
+    }
+
+    // re-file the current slot of level, return the slot index so the
+    // caller knows whether this level turned over too.
+    uint32_t cascade(int level) {
+        uint32_t slot = (_next >> (kRootBits + (level - 1) * kLevelBits)) & kLevelMask;
+        uint32_t index = takeSlot(level, slot);
+        while (index != kNil) {
+            uint32_t next = _nodes[index].next;
+            link(index);
+            index = next;
+        }
+        return slot;
+    }
+
+    static int bitmapWord(int level, uint32_t slot) {
+        return level == 0 ? (int)(slot >> 6) : 3 + level;
+    }
+
+    // next tick worth waking up for: the first busy level 0 slot before
+    // level 0 turns over, else the turn-over itself. _next itself when
+    // it is a turn-over whose cascade has not run yet.
+    void updateNextTick() {
+        if (_count == 0) {
+            _nextTick.store(kNever, std::memory_order_release);
+            return;
+        }
+        uint32_t pos = _next & kRootMask;
+        if (pos == 0 && upperBusy()) {
+            _nextTick.store(_next, std::memory_order_release);
+            return;
+        }
+        for (uint32_t word = pos >> 6; word < kRootSize / 64; ++word) {
+            uint64_t bits = _bitmap[word];
+            if (word == pos >> 6)
+                bits &= ~0ull << (pos & 63);
+            if (bits) {
+                uint32_t slot = word * 64 + lowestBit64(bits);
+                _nextTick.store(_next + (slot - pos), std::memory_order_release);
+                return;
+            }
+        }
+        _nextTick.store((_next | kRootMask) + 1, std::memory_order_release);
+    }
+
+    bool upperBusy() const {
+        for (int level = 1; level < kLevels; ++level) {
+            if (_bitmap[bitmapWord(level, 0)])
+                return true;
+        }
+        return false;
+    }
+
+    static int lowestBit64(uint64_t x) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, x);
+        return (int)index;
+#else
+        return __builtin_ctzll(x);
+#endif // _MSC_VER
+    }
+private:
+    Clock::time_point _start;
+    // next tick expire() has to process.
+    uint64_t _next;
+    size_t _count;
+    std::atomic<uint64_t> _nextTick;
+    std::vector<Node> _nodes;
+    uint32_t _free = kNil;
+    uint32_t _slots[kLevels][kRootSize];
+    // one bit per non-empty slot: 4 words for level 0, one per upper level.
+    uint64_t _bitmap[4 + kLevels - 1];
+};
+
+}// namespace
@@ -1,5 +1,3 @@
-#pragma once
-
 #include "util.h"
 #include "file.h"
 
@@ -8,6 +6,9 @@
 #ifdef _WIN32
 #include <shlwapi.h>
 #pragma comment(lib, "shlwapi.lib")
+#else
+#include <limits.h>
+#include <unistd.h>
 #endif // _WIN32
 
 